@@ -78,6 +78,14 @@
 
 //#define Z_LATE_ENABLE // Enable Z the last moment. Needed if your Z driver overheats.
 
+// Keep the Z drivers (RZ and LZ) off during galvo-only exposures, so the motors do not warm the vat.
+// Z is enabled Z_ENABLE_LEAD_TIME before the first queued Z move is due, judged from the planner queue,
+// and released Z_RELEASE_DELAY after the last Z move. Takes precedence over Z_LATE_ENABLE and never stalls
+// the step interrupt. The board has no current control, so "released" means the driver is disabled.
+//#define Z_POWER_MANAGEMENT
+#define Z_ENABLE_LEAD_TIME 50   // (ms)
+#define Z_RELEASE_DELAY 1000    // (ms)
+
 // A single Z stepper driver is usually used to drive 2 stepper motors.
 // Uncomment this define to utilize a separate stepper driver for each Z axis motor.
 // Only a few motherboards support this, like RAMPS, which have dual extruder support (the 2nd, often unused, extruder driver is used
@@ -135,6 +143,29 @@
 
 #define SD_FINISHED_STEPPERRELEASE true  //if sd support and the file is finished: disable steppers?
 #define SD_FINISHED_RELEASECOMMAND "M84 X Y Z E" // no z because of layer shift.
+// Bytes of the printed file read from the card at once. 512 (one card block) lets whole blocks
+// go straight into the buffer, smaller sizes save RAM but copy through the volume cache.
+#define SD_READ_BUFFER_SIZE 512
+// Runs of contiguous clusters kept for the printed file, so reading and seeking (M26) never
+// look into the FAT. A file in more pieces than this is read through the FAT as before.
+// Each run takes 8 bytes of RAM.
+#define SD_EXTENT_COUNT 8
+// Directory positions of the first files of the working directory, so the menu gets the
+// number of files and the n-th name without reading the directory again. 2 bytes each.
+#define SD_DIR_INDEX_SIZE 64
+// M28 writes into this many bytes of contiguous clusters with one multiple block write, the part
+// not used is freed at M29, M22 or kill(). A larger file goes on through the FAT. Must be a
+// multiple of 512.
+#define SD_UPLOAD_PREALLOCATE 4194304UL
+// M28 B<bytes> <filename> reads the file as raw bytes instead of G-code lines, see gcode_M28()
+//#define SD_BINARY_UPLOAD
+
+// The galvo DAC shares the SPI with the SD card, see spibus.h. Its clock is
+// F_CPU / 2^(1 + GALVO_SPI_RATE), 1 = 4 MHz on a 16 MHz board.
+#define GALVO_SPI_RATE 1
+// Drive the DAC from USART1 in SPI master mode (clock on XCK1/PD5, data on TXD1/PD3) instead,
+// so SD transfers never hold back a galvo update. Needs the DAC wired to those pins.
+//#define GALVO_USART_SPI
 
 // The hardware watchdog should halt the Microcontroller, in case the firmware gets stuck somewhere. However:
 // the Watchdog is not working well, so please only enable this for testing
@@ -155,6 +186,12 @@
 // so: v ^ 2 is proportional to number of steps we advance the extruder
 //#define ADVANCE
 
+// Measure the stepper interrupt with timer 1: min/avg/max and a duration histogram for block pop,
+// acceleration, cruise and deceleration interrupts, plus a count of missed step deadlines.
+// The durations include the serial and timer 0 interrupts that nest in the stepper interrupt.
+// M603 prints the profile, M603 R clears it. Costs ~150 bytes of RAM and a few us per step interrupt.
+//#define STEPPER_ISR_PROFILE
+
 // Arc interpretation settings:
 #define MM_PER_ARC_SEGMENT 1
 #define N_ARC_CORRECTION 25
@@ -185,7 +222,36 @@ const int dropsegments=5; //everything with less than this number of steps will
 
 //The ASCII buffer for recieving from the serial:
 #define MAX_CMD_SIZE 96
-#define BUFSIZE 4
+// Queued commands share CMDQUEUE_SIZE bytes, each takes its length + 3, up to BUFSIZE commands.
+// A line is read in place, so MAX_CMD_SIZE + 2 contiguous bytes must be free to start one.
+// 384 bytes is what the 4 fixed lines of 96 took before, BUFSIZE itself takes no RAM.
+#define CMDQUEUE_SIZE 384
+#define BUFSIZE 16
+
+// Extend every "ok" to "ok N<last line number> P<free planner blocks> B<free command lines>",
+// so host software can keep more than one command in flight. B counts lines of MAX_CMD_SIZE that
+// fit into the free bytes of CMDQUEUE_SIZE, so shorter lines usually leave room for more.
+//#define ADVANCED_OK
+
+// Binary move frames as an alternative to G-code lines for long hatch sequences. The host
+// switches to them with M610, the format is described in binprotocol.h. Costs ~140 bytes of RAM.
+//#define BINARY_PROTOCOL
+
+// Print SD jobs made by tools/binjob: the records of the binary protocol in a file with a layer
+// table (binprotocol.h), queued straight into the planner without going through G-code.
+// Needs SDSUPPORT and BINARY_PROTOCOL.
+//#define SD_BINARY_JOB
+
+#if !defined(SDSUPPORT) || !defined(BINARY_PROTOCOL)
+  #undef SD_BINARY_JOB
+#endif
+
+// Macro slots for command sequences repeated on every layer. M710 P<slot> records the following
+// commands, already parsed, until M711; M712 P<slot> runs them. A word written as Z#Z in the
+// recording takes the Z value of the M712, or is left out if the M712 has none.
+//#define MACROS
+#define MACRO_SLOTS 4
+#define MACRO_POOL_SIZE 256 // Bytes for all slots, a command takes 2 + 5 per word
 
 
 // Firmware based and LCD controled retract
@@ -151,9 +151,14 @@ enum AxisEnum {X_AXIS=0, Y_AXIS=1, RZ_AXIS=2, LZ_AXIS=3};
 
 void FlushSerialRequestResend();
 void ClearToSend();
+void serial_ok();
 
 void get_coordinates();
 void prepare_move();
+void prepare_binary_move(const float target[NUM_AXIS], float feed, int laser); // laser -1: record without power
+#ifdef SDSUPPORT
+void sd_print_finished(); // Reports the print time and releases the file
+#endif
 void kill();
 void Stop();
 
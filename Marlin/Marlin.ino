@@ -42,6 +42,8 @@
 #include "EEPROMwrite.h"
 #include "language.h"
 #include "pins_arduino.h"
+#include "binprotocol.h"
+#include "spibus.h"
 
 #define VERSION_STRING  "1.0.0"
 
@@ -51,7 +53,7 @@
 //Implemented Codes
 //-------------------
 // G0  -> G1
-// G1  - Coordinated Movement X Y Z E
+// G1  - Coordinated Movement X Y Z E, S sets the laser power for the move
 // G2  - CW ARC
 // G3  - CCW ARC
 // G4  - Dwell S<seconds> or P<milliseconds>
@@ -78,9 +80,9 @@
 // M23  - Select SD file (M23 filename.g)
 // M24  - Start/resume SD print
 // M25  - Pause SD print
-// M26  - Set SD position in bytes (M26 S12345)
+// M26  - Set SD position in bytes (M26 S12345), or the layer of an SD job (M26 L12, needs SD_BINARY_JOB)
 // M27  - Report SD print status
-// M28  - Start SD write (M28 filename.g)
+// M28  - Start SD write (M28 filename.g). M28 B<bytes> filename.g reads the file as raw bytes (needs SD_BINARY_UPLOAD)
 // M29  - Stop SD write
 // M30  - Delete file from SD (M30 filename.g)
 // M31  - Output time since last M109 or SD card start to serial
@@ -121,6 +123,14 @@
 // M600 - Laser on
 // M601 - Laser off
 // M602 - Galvo Debug
+// M603 - Report stepper ISR profile, M603 R clears it (needs STEPPER_ISR_PROFILE)
+// M604 - S1: the S of G0/G1 holds for that move only, moves without S are dark. S0: it holds until changed (default)
+// M605 - Report serial line counters, M605 R clears them
+// M606 - Time the G/M code table lookup
+// M610 - Read binary move frames from now on, see binprotocol.h (needs BINARY_PROTOCOL)
+// M710 - Record the following commands into macro slot P until M711 (needs MACROS)
+// M711 - End the recording
+// M712 - Run macro slot P, a word like Z#Z takes the Z of the M712, X#Y its Y (needs MACROS)
 // M999 - Restart after being stopped by error
 
 //Stepper Movement Variables
@@ -143,6 +153,9 @@ float max_pos[3] = { X_MAX_POS, Y_MAX_POS, Z_MAX_POS };
 uint8_t active_extruder = 0;
 unsigned char FanSpeed=0;
 unsigned char LaserPower=0;
+#if LASER_PIN > -1
+static bool laser_per_move = false; // M604 S1
+#endif
 
 #ifdef FWRETRACT
   bool autoretract_enabled=true;
@@ -162,19 +175,77 @@ static float feedrate = 1500.0, next_feedrate, saved_feedrate;
 static long gcode_N, gcode_LastN, Stopped_gcode_LastN = 0;
 
 static bool relative_mode = false;  //Determines Absolute or Relative Coordinates
-static bool relative_mode_e = false;  //Determines Absolute or Relative E Codes while in Absolute Coordinates mode. E is always relative in Relative Coordinates mode.
 
-static char cmdbuffer[BUFSIZE][MAX_CMD_SIZE];
-static bool fromsd[BUFSIZE];
-static int bufindr = 0;
-static int bufindw = 0;
-static int buflen = 0;
+// Command queue: a byte ring of entries [length][flags][text\0], each as long as its text.
+// An entry never wraps; a length of 0 (or the end of the ring) sends the reader back to the start.
+#define CMD_LEN    0       // Offsets inside an entry
+#define CMD_FLAGS  1
+#define CMD_TEXT   2
+#define CMD_FROMSD 1       // Flag: the line came from the SD card, don't acknowledge it
+#define CMD_CURRENT (&cmdqueue[bufindr + CMD_TEXT])  // Command being processed
+#define CMD_NEXT    (&cmdqueue[bufindw + CMD_TEXT])  // Line being read, see cmdqueue_reserve()
+
+static char cmdqueue[CMDQUEUE_SIZE];
+static int bufindr = 0;  // Offset of the oldest entry
+static int bufindw = 0;  // Offset where the next entry goes
+static int buflen = 0;   // Number of entries
 //static int i = 0;
 static char serial_char;
 static int serial_count = 0;
 static boolean comment_mode = false;
+static bool early_ok = false; // Acknowledge the line in get_command() already (G0-G3)
+
+// Serial line counters for M605, the firmware side of a host streaming benchmark
+static struct {
+  unsigned long lines;    // Lines queued
+  unsigned int resends;   // Lines rejected and asked for again
+} serial_stats;
+
+// What line_scan() learned about the serial line read so far
+#define LINE_START    0  // Before the first word
+#define LINE_N        1  // In the line number
+#define LINE_TEXT     2  // In the command, stored
+#define LINE_G        3  // In the number of a leading G word
+#define LINE_CHECKSUM 4  // After '*'
+static struct {
+  uint8_t state;
+  uint8_t checksum;      // XOR of all bytes in front of '*'
+  bool has_n, has_star;
+  long n;                // Line number
+  int received;          // Checksum sent after '*'
+  uint8_t m110;          // Characters of "M110" matched so far, 4 when seen
+  int8_t g;              // Number of the G word the line starts with, -1 without one
+} line = { LINE_START, 0, false, false, 0, 0, 0, -1 };
 static char *strchr_pointer; // just a pointer to find chars in the cmd string like X, Y, Z, E, etc
 
+// The words of the command being processed, split up once by parse_command()
+static struct {
+  char *line;             // Line the positions refer to, NULL for a command from a macro
+  char command;           // Letter of the first word ('G', 'M', 'T'), 0 if there is none
+  int code;               // Number of the first word
+  unsigned long seen;     // Bit n is set when letter 'A'+n is in the line
+  uint8_t pos[26];        // Offset of each letter in the line, for strchr_pointer
+  float value[26];        // Number following each letter
+} parsed;
+static uint8_t code_index; // Letter of the last code_seen(), 'A' = 0
+
+#ifdef MACROS
+// Recorded commands are kept as their parsed words, one command being a word count and the
+// letter of its first word (parsed.command) followed by that many macro_word_t. The slots lie back to back in macro_pool, in no particular order.
+#define MACRO_NONE 0xFF
+#define MACRO_PLACEHOLDER 0x80 // Set in macro_word_t.code when value is the index of an M712 letter
+typedef struct {
+  uint8_t code;           // Letter, 'A' = 0
+  float value;
+} macro_word_t;
+static uint8_t macro_pool[MACRO_POOL_SIZE];
+static int macro_start[MACRO_SLOTS];      // Offset of each slot in macro_pool
+static int macro_length[MACRO_SLOTS];
+static int macro_used;                    // Bytes of macro_pool taken by all slots
+static uint8_t macro_recording = MACRO_NONE;
+static bool macro_playing = false;        // No ok for the commands of a macro, M712 gets one
+#endif
+
 const int sensitive_pins[] = SENSITIVE_PINS; // Sensitive pin list for M42
 
 //static float tt = 0;
@@ -198,6 +269,10 @@ bool Stopped=false;
 //===========================================================================
 
 void get_arc_coordinates();
+void process_parsed();
+#if LASER_PIN > -1
+void prepare_laser_move();
+#endif
 bool setTargetedHotend(int code);
 
 void serial_echopair_P(const char *s_P, float v)
@@ -217,33 +292,99 @@ extern "C++"
  int freeMemory() {
     int free_memory;
 
-    if((int)__brkval == 0)
-      free_memory = ((int)&free_memory) - ((int)&__bss_end);
+    if(__brkval == 0)
+      free_memory = ((char *)&free_memory) - ((char *)&__bss_end);
     else
-      free_memory = ((int)&free_memory) - ((int)__brkval);
+      free_memory = ((char *)&free_memory) - ((char *)__brkval);
 
     return free_memory;
   }
 }
 
-//adds an command to the main command buffer
-//thats really done in a non-safe way.
-//needs overworking someday
 extern "C++"
 {
-  void enquecommand(const char *cmd)
+  // Makes sure `needed` contiguous bytes are free at bufindw, moving bufindw to the start of
+  // the ring when the end is too short. Only call it while no line is read into CMD_NEXT.
+  bool cmdqueue_reserve(int needed)
   {
-    if(buflen < BUFSIZE)
-    {
-      //this is dangerous if a mixing of serial and this happsens
-      strcpy(&(cmdbuffer[bufindw][0]),cmd);
-      SERIAL_ECHO_START;
-      SERIAL_ECHOPGM("enqueing \"");
-      SERIAL_ECHO(cmdbuffer[bufindw]);
-      SERIAL_ECHOLNPGM("\"");
-      bufindw= (bufindw + 1)%BUFSIZE;
-      buflen += 1;
+    if(buflen >= BUFSIZE)
+      return false;
+    if(buflen == 0) {
+      bufindr = bufindw = 0;
+      return true;
     }
+    if(bufindw > bufindr) {
+      if(CMDQUEUE_SIZE - bufindw >= needed)
+        return true;
+      if(bufindr < needed)
+        return false;
+      if(bufindw < CMDQUEUE_SIZE)
+        cmdqueue[bufindw + CMD_LEN] = 0;
+      bufindw = 0;
+      return true;
+    }
+    return (bufindr - bufindw >= needed); // Equal offsets here mean the ring is full
+  }
+
+  // Queues the line that was read into CMD_NEXT
+  void cmdqueue_commit(uint8_t flags)
+  {
+    uint8_t len = CMD_TEXT + strlen(CMD_NEXT) + 1;
+    cmdqueue[bufindw + CMD_LEN] = len;
+    cmdqueue[bufindw + CMD_FLAGS] = flags;
+    bufindw += len;
+    buflen++;
+  }
+
+  #ifdef ADVANCED_OK
+  // Lines that are sure to fit for the B of the ok: each needs CMD_TEXT + MAX_CMD_SIZE contiguous
+  // bytes while it is read, whatever its length turns out to be. A line half read is in flight.
+  int cmdqueue_free_lines()
+  {
+    const int size = CMD_TEXT + MAX_CMD_SIZE;
+    int lines;
+    if(buflen == 0)
+      lines = CMDQUEUE_SIZE / size;
+    else if(bufindw > bufindr)
+      lines = (CMDQUEUE_SIZE - bufindw) / size + bufindr / size;
+    else
+      lines = (bufindr - bufindw) / size;
+    if(lines > BUFSIZE - buflen)
+      lines = BUFSIZE - buflen;
+    if(serial_count > 0 && lines > 0)
+      lines--;
+    return lines;
+  }
+  #endif
+
+  // Drops the oldest entry once it has been processed
+  void cmdqueue_advance()
+  {
+    bufindr += (uint8_t)cmdqueue[bufindr + CMD_LEN];
+    buflen--;
+    if(buflen == 0)
+      bufindr = bufindw; // Also right when a line is being read at bufindw
+    else if(bufindr >= CMDQUEUE_SIZE || cmdqueue[bufindr + CMD_LEN] == 0)
+      bufindr = 0;
+  }
+
+  //adds an command to the main command buffer
+  void enquecommand(const char *cmd)
+  {
+    // A line half read from serial or SD sits at bufindw, it is moved behind the new entry.
+    int partial_at = bufindw + CMD_TEXT;
+    uint8_t partial = serial_count;
+    uint8_t size = CMD_TEXT + strlen(cmd) + 1;
+    if(!cmdqueue_reserve(size + (partial ? CMD_TEXT + MAX_CMD_SIZE : 0)))
+      return;
+    if(partial)
+      memmove(CMD_NEXT + size, &cmdqueue[partial_at], partial);
+    strcpy(CMD_NEXT, cmd);
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPGM("enqueing \"");
+    SERIAL_ECHO(CMD_NEXT);
+    SERIAL_ECHOLNPGM("\"");
+    cmdqueue_commit(0);
   }
 }
 
@@ -302,8 +443,7 @@ extern "C++"
   void setup_galvos()
   {
     #ifdef GALVO_SS_PIN
-      pinMode (GALVO_SS_PIN, OUTPUT);
-      SPI.begin();   
+      spi_bus_init();
   
       //Timer1.initialize(1000); //1000/16Mhz
       //Timer1.attachInterrupt(timed_refresh_of_galvos); // blinkLED to run every 0.15 seconds
@@ -355,11 +495,6 @@ void setup()
   SERIAL_ECHO(freeMemory());
   SERIAL_ECHOPGM(MSG_PLANNER_BUFFER_BYTES);
   SERIAL_ECHOLN((int)sizeof(block_t)*BLOCK_BUFFER_SIZE);
-  for(int8_t i = 0; i < BUFSIZE; i++)
-  {
-    fromsd[i] = false;
-  }
-  
   EEPROM_RetrieveSettings(); // loads data from EEPROM if available
 
   for(int8_t i=0; i < NUM_AXIS; i++)
@@ -377,8 +512,19 @@ void setup()
 
 void loop()
 {
+  #ifdef BINARY_PROTOCOL
+  if(bin_mode) {
+    if(buflen == 0) // G-code queued before M610 goes first
+      bin_get_frame();
+  }
+  else
+  #endif
   if(buflen < (BUFSIZE-1))
     get_command();
+  #ifdef SD_BINARY_JOB
+  if(card.sdprinting && card.binaryJob && buflen == 0)
+    bin_job_run();
+  #endif
   #ifdef SDSUPPORT
   card.checkautostart(false);
   #endif
@@ -387,10 +533,10 @@ void loop()
     #ifdef SDSUPPORT
       if(card.saving)
       {
-	if(strstr(cmdbuffer[bufindr],"M29") == NULL)
+	if(strstr(CMD_CURRENT,"M29") == NULL)
 	{
-	  card.write_command(cmdbuffer[bufindr]);
-	  SERIAL_PROTOCOLLNPGM(MSG_OK);
+	  card.write_command(CMD_CURRENT);
+	  serial_ok();
 	}
 	else
 	{
@@ -405,8 +551,7 @@ void loop()
     #else
       process_commands();
     #endif //SDSUPPORT
-    buflen = (buflen-1);
-    bufindr = (bufindr + 1)%BUFSIZE;
+    cmdqueue_advance();
   }
   //check heater every n milliseconds
   manage_inactivity();
@@ -415,117 +560,197 @@ void loop()
 
 extern "C++"
 {
+  // Clears what line_scan() collected, for the next line
+  void line_reset()
+  {
+    line.checksum = 0;
+    line.state = LINE_START;
+    line.has_n = false;
+    line.has_star = false;
+    line.n = 0;
+    line.received = 0;
+    line.m110 = 0;
+    line.g = -1;
+  }
+
+  // Takes one byte of a serial line (comments are not passed in). Keeps checksum, line number,
+  // checksum after '*', M110 and the G number up to date, so the finished line needs no rescan.
+  // Returns false for bytes not to store: the leading N word, '*' and what follows it.
+  bool line_scan(char c)
+  {
+    if(line.state == LINE_CHECKSUM) {
+      if(c >= '0' && c <= '9') line.received = line.received * 10 + (c - '0');
+      return false;
+    }
+    if(c == '*') {
+      line.state = LINE_CHECKSUM;
+      line.has_star = true;
+      return false;
+    }
+    line.checksum ^= c;
+    switch(line.state) {
+      case LINE_START:
+        if(c == ' ') return false;
+        if(c == 'N' && !line.has_n) {
+          line.has_n = true;
+          line.state = LINE_N;
+          return false;
+        }
+        line.state = (c == 'G') ? LINE_G : LINE_TEXT;
+        break;
+      case LINE_N:
+        if(c >= '0' && c <= '9') {
+          line.n = line.n * 10 + (c - '0');
+          return false;
+        }
+        if(c == ' ') {
+          line.state = LINE_START;
+          return false;
+        }
+        line.state = (c == 'G') ? LINE_G : LINE_TEXT;
+        break;
+      case LINE_G:
+        if(c >= '0' && c <= '9') {
+          int g = ((line.g < 0) ? 0 : line.g * 10) + (c - '0');
+          line.g = (g > 99) ? 99 : g;
+          return true;
+        }
+        line.state = LINE_TEXT;
+        break;
+    }
+    // LINE_TEXT
+    if(line.m110 < 4)
+      line.m110 = (c == "M110"[line.m110]) ? line.m110 + 1 : (c == 'M');
+    return true;
+  }
+
+  #ifdef SDSUPPORT
+  // End of the printed file, G-code or SD job
+  void sd_print_finished()
+  {
+    SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
+    stoptime=millis();
+    char time[30];
+    unsigned long t=(stoptime-starttime)/1000;
+    int sec,min;
+    min=t/60;
+    sec=t%60;
+    sprintf(time,"%i min, %i sec",min,sec);
+    SERIAL_ECHO_START;
+    SERIAL_ECHOLN(time);
+    card.printingHasFinished();
+    card.checkautostart(true);
+  }
+  #endif
+
   void get_command() 
   { 
     while( MYSERIAL.available() > 0  && buflen < BUFSIZE) {
+      if(serial_count == 0 && !cmdqueue_reserve(CMD_TEXT + MAX_CMD_SIZE))
+        return; // Wait until there is room for a whole line
       serial_char = MYSERIAL.read();
       if(serial_char == '\n' || 
         serial_char == '\r' || 
         (serial_char == ':' && comment_mode == false) || 
         serial_count >= (MAX_CMD_SIZE - 1) ) 
       {
-        if(!serial_count) { //if empty line
-          comment_mode = false; //for new command
-        return;
-      }
-      cmdbuffer[bufindw][serial_count] = 0; //terminate string
-      if(!comment_mode){
         comment_mode = false; //for new command
-        fromsd[bufindw] = false;
-        if(strstr(cmdbuffer[bufindw], "N") != NULL)
+        if(!serial_count && !line.has_n && !line.has_star) { //if empty line
+          line_reset();
+          return;
+        }
+        while(serial_count > 0 && CMD_NEXT[serial_count - 1] == ' ')
+          serial_count--; // Drop the blank in front of '*'
+        CMD_NEXT[serial_count] = 0; //terminate string
+        serial_count = 0; //clear buffer
+        if(line.has_n)
         {
-          strchr_pointer = strchr(cmdbuffer[bufindw], 'N');
-          gcode_N = (strtol(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL, 10));
-          if(gcode_N != gcode_LastN+1 && (strstr(cmdbuffer[bufindw], "M110") == NULL) ) {
+          gcode_N = line.n;
+          if(gcode_N != gcode_LastN+1 && line.m110 < 4) {
             SERIAL_ERROR_START;
             SERIAL_ERRORPGM(MSG_ERR_LINE_NO);
             SERIAL_ERRORLN(gcode_LastN);
             //Serial.println(gcode_N);
             FlushSerialRequestResend();
-            serial_count = 0;
+            line_reset();
             return;
           }
 
-          if(strstr(cmdbuffer[bufindw], "*") != NULL)
-          {
-            byte checksum = 0;
-            byte count = 0;
-            while(cmdbuffer[bufindw][count] != '*') checksum = checksum^cmdbuffer[bufindw][count++];
-            strchr_pointer = strchr(cmdbuffer[bufindw], '*');
-
-            if( (int)(strtod(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL)) != checksum) {
-              SERIAL_ERROR_START;
-              SERIAL_ERRORPGM(MSG_ERR_CHECKSUM_MISMATCH);
-              SERIAL_ERRORLN(gcode_LastN);
-              FlushSerialRequestResend();
-              serial_count = 0;
-              return;
-            }
-            //if no errors, continue parsing
-          }
-          else 
+          if(!line.has_star)
           {
             SERIAL_ERROR_START;
             SERIAL_ERRORPGM(MSG_ERR_NO_CHECKSUM);
             SERIAL_ERRORLN(gcode_LastN);
             FlushSerialRequestResend();
-            serial_count = 0;
+            line_reset();
+            return;
+          }
+          if(line.received != line.checksum) {
+            SERIAL_ERROR_START;
+            SERIAL_ERRORPGM(MSG_ERR_CHECKSUM_MISMATCH);
+            SERIAL_ERRORLN(gcode_LastN);
+            FlushSerialRequestResend();
+            line_reset();
             return;
           }
 
           gcode_LastN = gcode_N;
           //if no errors, continue parsing
         }
-        else  // if we don't receive 'N' but still see '*'
+        else if(line.has_star) // if we don't receive 'N' but still see '*'
         {
-          if((strstr(cmdbuffer[bufindw], "*") != NULL))
-          {
-            SERIAL_ERROR_START;
-            SERIAL_ERRORPGM(MSG_ERR_NO_LINENUMBER_WITH_CHECKSUM);
-            SERIAL_ERRORLN(gcode_LastN);
-            serial_count = 0;
-            return;
-          }
+          SERIAL_ERROR_START;
+          SERIAL_ERRORPGM(MSG_ERR_NO_LINENUMBER_WITH_CHECKSUM);
+          SERIAL_ERRORLN(gcode_LastN);
+          line_reset();
+          return;
         }
-        if((strstr(cmdbuffer[bufindw], "G") != NULL)){
-          strchr_pointer = strchr(cmdbuffer[bufindw], 'G');
-          switch((int)((strtod(&cmdbuffer[bufindw][strchr_pointer - cmdbuffer[bufindw] + 1], NULL)))){
-          case 0:
-          case 1:
-          case 2:
-          case 3:
-            if(Stopped == false) { // If printer is stopped by an error the G[0-3] codes are ignored.
-	    #ifdef SDSUPPORT
-            if(card.saving)
-              break;
-	    #endif //SDSUPPORT
-            SERIAL_PROTOCOLLNPGM(MSG_OK); 
-            }
-            else {
-              SERIAL_ERRORLNPGM(MSG_ERR_STOPPED);
-            }
-            break;
-          default:
+        switch(line.g) {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+          if(Stopped == false) { // If printer is stopped by an error the G[0-3] codes are ignored.
+          #ifdef SDSUPPORT
+          if(card.saving)
             break;
+          #endif //SDSUPPORT
+          #ifdef MACROS
+          if(macro_recording != MACRO_NONE)
+            break; // Acknowledged when recorded
+          #endif
+          early_ok = true; // Sent once the line is queued, so the free slots are counted right
           }
-
+          else {
+            SERIAL_ERRORLNPGM(MSG_ERR_STOPPED);
+          }
+          break;
+        default:
+          break;
+        }
+        line_reset();
+        cmdqueue_commit(0);
+        serial_stats.lines++;
+        if(early_ok) {
+          early_ok = false;
+          serial_ok();
         }
-        bufindw = (bufindw + 1)%BUFSIZE;
-        buflen += 1;
       }
-      serial_count = 0; //clear buffer
-    }
-    else
-    {
-      if(serial_char == ';') comment_mode = true;
-      if(!comment_mode) cmdbuffer[bufindw][serial_count++] = serial_char;
+      else
+      {
+        if(serial_char == ';') comment_mode = true;
+        if(!comment_mode && line_scan(serial_char)) CMD_NEXT[serial_count++] = serial_char;
+      }
     }
-  }
   #ifdef SDSUPPORT
-  if(!card.sdprinting || serial_count!=0){
+  if(!card.sdprinting || card.binaryJob || serial_count!=0){
     return;
   }
   while( !card.eof()  && buflen < BUFSIZE) {
+    if(serial_count == 0 && !cmdqueue_reserve(CMD_TEXT + MAX_CMD_SIZE))
+      return;
+    if(serial_count == 0 && buflen > 0 && card.readBufferEmpty())
+      return; // card.prefetch() refills it while the queued commands run
     int16_t n=card.get();
     serial_char = (char)n;
     if(serial_char == '\n' || 
@@ -534,38 +759,22 @@ extern "C++"
        serial_count >= (MAX_CMD_SIZE - 1)||n==-1) 
     {
       if(card.eof()){
-        SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
-        stoptime=millis();
-        char time[30];
-        unsigned long t=(stoptime-starttime)/1000;
-        int sec,min;
-        min=t/60;
-        sec=t%60;
-        sprintf(time,"%i min, %i sec",min,sec);
-        SERIAL_ECHO_START;
-        SERIAL_ECHOLN(time);
-        card.printingHasFinished();
-        card.checkautostart(true);
-        
+        sd_print_finished();
       }
       if(!serial_count)
       {
         comment_mode = false; //for new command
         return; //if empty line
       }
-      cmdbuffer[bufindw][serial_count] = 0; //terminate string
-//      if(!comment_mode){
-        fromsd[bufindw] = true;
-        buflen += 1;
-        bufindw = (bufindw + 1)%BUFSIZE;
-//      }     
+      CMD_NEXT[serial_count] = 0; //terminate string
+      cmdqueue_commit(CMD_FROMSD);
       comment_mode = false; //for new command
       serial_count = 0; //clear buffer
     }
     else
     {
       if(serial_char == ';') comment_mode = true;
-      if(!comment_mode) cmdbuffer[bufindw][serial_count++] = serial_char;
+      if(!comment_mode) CMD_NEXT[serial_count++] = serial_char;
     }
   }
   
@@ -576,25 +785,161 @@ extern "C++"
 
 extern "C++"
 {
+  static const float negative_powers_of_ten[] PROGMEM = {1e0, 1e-1, 1e-2, 1e-3, 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9};
+
+  // Decimal number as written by slicers ("-12.345", "+.5", "1200"), without strtod.
+  // The digits are collected as an integer and scaled with one float multiply.
+  // Digits beyond 9 significant ones are dropped. There is no exponent notation.
+  float parse_float(const char *p, char **end)
+  {
+    const char *start = p;       // Like strtod(), *end is p if there is no number
+    while(*p == ' ') p++;
+    bool negative = (*p == '-');
+    if(*p == '-' || *p == '+') p++;
+
+    unsigned long mantissa = 0;
+    uint8_t digits = 0;          // Significant digits in mantissa
+    int8_t scale = 0;            // Decimal exponent of mantissa
+    bool any = false;
+    for(; *p >= '0' && *p <= '9'; p++) {
+      any = true;
+      if(digits < 9) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if(mantissa != 0) digits++;
+      }
+      else
+        scale++;
+    }
+    if(*p == '.') {
+      p++;
+      uint8_t zeros = 0;         // Held back, trailing zeros ("1.500") would only cost precision
+      for(; *p >= '0' && *p <= '9'; p++) {
+        any = true;
+        if(*p == '0' && mantissa != 0) {
+          zeros++;
+          continue;
+        }
+        for(; zeros > 0 && digits < 9 && scale > -9; zeros--) {
+          mantissa = mantissa * 10;
+          digits++;
+          scale--;
+        }
+        if(digits < 9 && scale > -9) {
+          mantissa = mantissa * 10 + (*p - '0');
+          if(mantissa != 0) digits++;
+          scale--;
+        }
+      }
+    }
+    if(!any) {
+      if(end) *end = (char *)start;
+      return 0.0;
+    }
+    if(end) *end = (char *)p;
+
+    float result = mantissa;
+    if(scale < 0)
+      result *= pgm_read_float_near(&negative_powers_of_ten[-scale]);
+    else
+      while(scale-- > 0) result *= 10.0;
+    return negative ? -result : result;
+  }
+
+  // Integer counterpart of parse_float(), exact over the whole long range. A fraction is cut off.
+  long parse_long(const char *p)
+  {
+    while(*p == ' ') p++;
+    bool negative = (*p == '-');
+    if(*p == '-' || *p == '+') p++;
+    unsigned long result = 0;
+    for(; *p >= '0' && *p <= '9'; p++)
+      result = result * 10 + (*p - '0');
+    return negative ? -(long)result : (long)result;
+  }
+
+  // Split the line into letter/value words in one pass. Like strchr() used to, the first
+  // occurrence of a letter counts. A leading N word and the checksum after '*' are not part
+  // of the command: line_scan() drops them from serial lines, but lines read from the SD
+  // card keep them.
+  void parse_command(char *cmd)
+  {
+    parsed.line = cmd;
+    parsed.seen = 0;
+    parsed.command = 0;
+    parsed.code = 0;
+    char *p = cmd;
+    while(*p == ' ') p++;
+    if(*p == 'N') {
+      p++;
+      if(*p == '-') p++;
+      while(*p >= '0' && *p <= '9') p++;
+    }
+    while(*p != '\0' && *p != '*') {
+      uint8_t i = *p - 'A';
+      if(i < 26) {
+        char *end = p + 1;
+        if(!(parsed.seen & (1UL << i))) {
+          parsed.seen |= (1UL << i);
+          parsed.pos[i] = p - cmd;
+          parsed.value[i] = parse_float(p + 1, &end);
+          if(parsed.seen == (1UL << i)) { // First word, it decides what the line does
+            parsed.command = *p;
+            parsed.code = parse_long(p + 1);
+          }
+        }
+        #ifdef MACROS
+          // Placeholder of a recorded command, X#Y. Its letter is no word of its own.
+          if(p[1] == '#' && p[2] >= 'A' && p[2] <= 'Z')
+            end = p + 3;
+        #endif
+        p = (end > p + 1) ? end : p + 1;
+      }
+      else
+        p++;
+    }
+  }
+
   float code_value() 
   { 
-    return (strtod(&cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], NULL)); 
+    if(code_index >= 26) return 0.0;
+    return parsed.value[code_index];
   }
 
   long code_value_long() 
   { 
-    return (strtol(&cmdbuffer[bufindr][strchr_pointer - cmdbuffer[bufindr] + 1], NULL, 10)); 
+    if(strchr_pointer == NULL) return (long)code_value(); // Not seen, or from a macro
+    return parse_long(strchr_pointer + 1);
   }
 
   bool code_seen(char code_string[]) //Return True if the string was found
   { 
-    return (strstr(cmdbuffer[bufindr], code_string) != NULL); 
+    return (strstr(CMD_CURRENT, code_string) != NULL); 
   }  
 
+  // Text after the command word, the file name of "M23 part.g". process_parsed() finds the
+  // handler without code_seen(), so strchr_pointer can not be used for it. Empty for a
+  // command from a macro, which keeps no text.
+  char *command_text()
+  {
+    static char none[] = "";
+    if(parsed.line == NULL || parsed.command == 0)
+      return none;
+    char *p = parsed.line + parsed.pos[parsed.command - 'A'] + 1;
+    while(*p == '-' || (*p >= '0' && *p <= '9')) p++;
+    while(*p == ' ') p++;
+    return p;
+  }
+
   bool code_seen(char code)
   {
-    strchr_pointer = strchr(cmdbuffer[bufindr], code);
-    return (strchr_pointer != NULL);  //Return True if a character was found
+    code_index = code - 'A';
+    if(code_index >= 26 || !(parsed.seen & (1UL << code_index))) {
+      code_index = 0xFF;
+      strchr_pointer = NULL;
+      return false;
+    }
+    strchr_pointer = (parsed.line != NULL) ? parsed.line + parsed.pos[code_index] : NULL;
+    return true;
   }
 
   #define DEFINE_PGM_READ_ANY(type, reader)		\
@@ -678,437 +1023,584 @@ extern "C++"
 }
 #define HOMEAXIS(LETTER) homeaxis(LETTER##_AXIS)
 
+#ifdef MACROS
 extern "C++"
 {
-  void process_commands()
+  // Frees the slot and starts recording into it at the end of the pool
+  void macro_begin(uint8_t slot)
   {
-    unsigned long codenum; //throw away variable
-    char *starpos = NULL;
+    int start = macro_start[slot], length = macro_length[slot];
+    memmove(&macro_pool[start], &macro_pool[start + length], macro_used - start - length);
+    for(uint8_t i = 0; i < MACRO_SLOTS; i++)
+      if(macro_start[i] > start)
+        macro_start[i] -= length;
+    macro_used -= length;
+    macro_start[slot] = macro_used;
+    macro_length[slot] = 0;
+    macro_recording = slot;
+  }
 
-    if(code_seen('G'))
-    {
-      switch((int)code_value())
-      {
-      case 0: // G0 -> G1
-      case 1: // G1
-        if(Stopped == false) {
-          get_coordinates(); // For X Y Z E F
-          prepare_move();
-          //ClearToSend();
-        return;
-        }
-      //break;
-      case 2: // G2  - CW ARC
-        if(Stopped == false) {
-          get_arc_coordinates();
-          prepare_arc_move(true);
-        return;
-        }
-      case 3: // G3  - CCW ARC
-        if(Stopped == false) {
-          get_arc_coordinates();
-          prepare_arc_move(false);
-        return;
-        }
-      case 4: // G4 dwell
-        codenum = 0;
-        if(code_seen('P')) codenum = code_value(); // milliseconds to wait
-        if(code_seen('S')) codenum = code_value() * 1000; // seconds to wait
-      
-        st_synchronize();
-        codenum += millis();  // keep track of when we started waiting
-        previous_millis_cmd = millis();
-        while(millis()  < codenum ){
-          manage_inactivity();
-        }
-        break;
-        #ifdef FWRETRACT  
-        case 10: // G10 retract
-          if(!retracted) 
-        {
-          destination[X_AXIS]=current_position[X_AXIS];
-          destination[Y_AXIS]=current_position[Y_AXIS];
-          destination[RZ_AXIS]=current_position[RZ_AXIS]; 
-          current_position[RZ_AXIS]+=-retract_zlift;
-          destination[LZ_AXIS]=current_position[LZ_AXIS]-retract_length; 
-          feedrate=retract_feedrate;
-          retracted=true;
-          prepare_move();
-        }
-      
-        break;
-        case 11: // G10 retract_recover
-        if(!retracted) 
-        {
-          destination[X_AXIS]=current_position[X_AXIS];
-          destination[Y_AXIS]=current_position[Y_AXIS];
-          destination[RZ_AXIS]=current_position[RZ_AXIS]; 
-        
-          current_position[RZ_AXIS]+=retract_zlift;
-          current_position[LZ_AXIS]+=-retract_recover_length; 
-          feedrate=retract_recover_feedrate;
-          retracted=false;
-          prepare_move();
-        }
-        break;
-        #endif //FWRETRACT
-        case 28: //G28 Home all Axis one at a time
-          saved_feedrate = feedrate;
-          saved_feedmultiply = feedmultiply;
-          feedmultiply = 100;
-          previous_millis_cmd = millis();
-      
-          enable_endstops(true);
-      
-          for(int8_t i=0; i < NUM_AXIS; i++) {
-            destination[i] = current_position[i];
-          }
-          feedrate = 0.0;
-          home_all_axis = !((code_seen(axis_codes[0])) || (code_seen(axis_codes[1])) || (code_seen(axis_codes[2])));
-      
-          #if Z_HOME_DIR > 0                      // If homing away from BED do Z first
-          if((home_all_axis) || (code_seen(axis_codes[RZ_AXIS]))) {
-            HOMEAXIS(Z);
-          }
-          #endif
-      
-          #ifdef QUICK_HOME
-          if((home_all_axis)||( code_seen(axis_codes[X_AXIS]) && code_seen(axis_codes[Y_AXIS])) )  //first diagonal move
-          {
-            current_position[X_AXIS] = 0;current_position[Y_AXIS] = 0;  
-
-            plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS], current_position[LZ_AXIS]); 
-            destination[X_AXIS] = 1.5 * X_MAX_LENGTH * X_HOME_DIR;destination[Y_AXIS] = 1.5 * Y_MAX_LENGTH * Y_HOME_DIR;  
-            feedrate = homing_feedrate[X_AXIS]; 
-            if(homing_feedrate[Y_AXIS]<feedrate)
-              feedrate =homing_feedrate[Y_AXIS]; 
-              plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[RZ_AXIS], destination[LZ_AXIS], feedrate/60, active_extruder);
-              st_synchronize();
-    
-              axis_is_at_home(X_AXIS);
-              axis_is_at_home(Y_AXIS);
-              plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS], current_position[LZ_AXIS]);
-              destination[X_AXIS] = current_position[X_AXIS];
-              destination[Y_AXIS] = current_position[Y_AXIS];
-              plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[RZ_AXIS], destination[LZ_AXIS], feedrate/60, active_extruder);
-              feedrate = 0.0;
-              st_synchronize();
-              endstops_hit_on_purpose();
-          }
-        #endif
-      
-        if((home_all_axis) || (code_seen(axis_codes[X_AXIS]))) 
-        {
-            HOMEAXIS(X);
-        }
+  // Called with every parsed command. Stores it while recording and returns true if it did.
+  bool macro_record()
+  {
+    if(macro_recording == MACRO_NONE)
+      return false;
+    if(parsed.command == 'M') {
+      int code = parsed.code;
+      if(code == 711) {
+        macro_recording = MACRO_NONE;
+        return false; // M711 is acknowledged as usual
+      }
+      if(code == 710 || code == 712 || code == 23 || code == 28 || code == 29 || code == 30) {
+        SERIAL_ERROR_START;
+        SERIAL_ERRORLNPGM("Command can not be recorded in a macro");
+        ClearToSend();
+        return true;
+      }
+    }
 
-        if((home_all_axis) || (code_seen(axis_codes[Y_AXIS]))) {
-          HOMEAXIS(Y);
-        }
-      
-        #if Z_HOME_DIR < 0                      // If homing towards BED do Z last
-          if((home_all_axis) || (code_seen(axis_codes[RZ_AXIS]))) {
-          HOMEAXIS(RZ);
-        }
-        #endif
-      
-        if(code_seen(axis_codes[X_AXIS])) 
-        {
-          if(code_value_long() != 0) {
-          current_position[X_AXIS]=code_value()+add_homeing[0];
-          }
-        }
+    uint8_t count = 0;
+    for(uint8_t i = 0; i < 26; i++)
+      if(parsed.seen & (1UL << i)) count++;
+    int end = macro_used;
+    if(end + 2 + count * (int)sizeof(macro_word_t) > MACRO_POOL_SIZE) {
+      SERIAL_ERROR_START;
+      SERIAL_ERRORLNPGM("Macro pool full, recording stopped");
+      macro_used -= macro_length[macro_recording]; // Drop what was recorded
+      macro_length[macro_recording] = 0;
+      macro_recording = MACRO_NONE;
+      ClearToSend();
+      return true;
+    }
 
-        if(code_seen(axis_codes[Y_AXIS])) {
-          if(code_value_long() != 0) {
-            current_position[Y_AXIS]=code_value()+add_homeing[1];
-          }
-        }
+    macro_pool[end++] = count;
+    macro_pool[end++] = parsed.command;
+    for(uint8_t i = 0; i < 26; i++) {
+      if(!(parsed.seen & (1UL << i)))
+        continue;
+      macro_word_t word;
+      word.code = i;
+      word.value = parsed.value[i];
+      const char *p = parsed.line + parsed.pos[i] + 1;
+      if(p[0] == '#' && p[1] >= 'A' && p[1] <= 'Z') {
+        word.code |= MACRO_PLACEHOLDER;
+        word.value = p[1] - 'A';
+      }
+      memcpy(&macro_pool[end], &word, sizeof(word));
+      end += sizeof(word);
+    }
+    // The slot being recorded is the last one in the pool
+    macro_length[macro_recording] += end - macro_used;
+    macro_used = end;
+    ClearToSend();
+    return true;
+  }
 
-        if(code_seen(axis_codes[RZ_AXIS])) {
-          if(code_value_long() != 0) {
-            current_position[RZ_AXIS]=code_value()+add_homeing[2];
-          }
-        }
-        plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS], current_position[LZ_AXIS]);
-      
-        #ifdef ENDSTOPS_ONLY_FOR_HOMING
-          enable_endstops(false);
-        #endif
-      
-        feedrate = saved_feedrate;
-        feedmultiply = saved_feedmultiply;
-        previous_millis_cmd = millis();
-        endstops_hit_on_purpose();
-        break;
-      case 90: // G90
-        relative_mode = false;
-        break;
-      case 91: // G91
-        relative_mode = true;
-        break;
-      case 92: // G92
-        st_synchronize();
-        for(int8_t i=0; i < NUM_AXIS; i++) {
-          if(code_seen(axis_codes[i])) { 
-            if(i == LZ_AXIS)
-            {
-              current_position[i] = code_value()+add_homeing[2];
-            }
-            else
-            {
-              current_position[i] = code_value()+add_homeing[i];  
-            }
-          plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS], current_position[LZ_AXIS]);
-          }
+  // Runs the commands of a slot with the words of the M712 filling in the placeholders.
+  // A placeholder without a matching word leaves its word out.
+  void macro_play(uint8_t slot)
+  {
+    unsigned long args_seen = parsed.seen;
+    float args[26];
+    memcpy(args, parsed.value, sizeof(args));
+
+    macro_playing = true;
+    int p = macro_start[slot], end = p + macro_length[slot];
+    while(p < end && !Stopped) {
+      uint8_t count = macro_pool[p++];
+      parsed.line = NULL;
+      parsed.command = macro_pool[p++];
+      parsed.seen = 0;
+      for(uint8_t n = 0; n < count; n++) {
+        macro_word_t word;
+        memcpy(&word, &macro_pool[p], sizeof(word));
+        p += sizeof(word);
+        uint8_t i = word.code & ~MACRO_PLACEHOLDER;
+        if(word.code & MACRO_PLACEHOLDER) {
+          uint8_t arg = (uint8_t)word.value;
+          if(!(args_seen & (1UL << arg)))
+            continue;
+          word.value = args[arg];
         }
-        break;
+        parsed.seen |= (1UL << i);
+        parsed.value[i] = word.value;
+      }
+      if(parsed.command != 0)
+        parsed.code = (int)parsed.value[parsed.command - 'A'];
+      process_parsed();
+    }
+    macro_playing = false;
+  }
+}
+#endif //MACROS
+
+extern "C++"
+{
+  static void gcode_G4() // G4 dwell
+  {
+    unsigned long codenum;
+    codenum = 0;
+    if(code_seen('P')) codenum = code_value(); // milliseconds to wait
+    if(code_seen('S')) codenum = code_value() * 1000; // seconds to wait
+
+    st_synchronize();
+    codenum += millis();  // keep track of when we started waiting
+    previous_millis_cmd = millis();
+    while(millis()  < codenum ){
+      manage_inactivity();
+    }
+  }
+
+  #ifdef FWRETRACT
+  static void gcode_G10() // G10 retract
+  {
+    if(!retracted)
+    {
+      destination[X_AXIS]=current_position[X_AXIS];
+      destination[Y_AXIS]=current_position[Y_AXIS];
+      destination[RZ_AXIS]=current_position[RZ_AXIS];
+      current_position[RZ_AXIS]+=-retract_zlift;
+      destination[LZ_AXIS]=current_position[LZ_AXIS]-retract_length;
+      feedrate=retract_feedrate;
+      retracted=true;
+      prepare_move();
     }
   }
 
-  else if(code_seen('M'))
+  static void gcode_G11() // G11 retract_recover
   {
-    switch( (int)code_value() ) 
+    if(!retracted)
     {
+      destination[X_AXIS]=current_position[X_AXIS];
+      destination[Y_AXIS]=current_position[Y_AXIS];
+      destination[RZ_AXIS]=current_position[RZ_AXIS];
+
+      current_position[RZ_AXIS]+=retract_zlift;
+      current_position[LZ_AXIS]+=-retract_recover_length;
+      feedrate=retract_recover_feedrate;
+      retracted=false;
+      prepare_move();
+    }
+  }
+  #endif
 
-    case 17:
-        enable_x(); 
-        enable_y(); 
-        enable_rz(); 
-        enable_lz(); 
-      break;
+  static void gcode_G28() // G28 Home all Axis one at a time
+  {
+    saved_feedrate = feedrate;
+    saved_feedmultiply = feedmultiply;
+    feedmultiply = 100;
+    previous_millis_cmd = millis();
 
-#ifdef SDSUPPORT
-    case 20: // M20 - list SD card
-      SERIAL_PROTOCOLLNPGM(MSG_BEGIN_FILE_LIST);
-      card.ls();
-      SERIAL_PROTOCOLLNPGM(MSG_END_FILE_LIST);
-      break;
-    case 21: // M21 - init SD card
-      
-      card.initsd();
-      
-      break;
-    case 22: //M22 - release SD card
-      card.release();
-
-      break;
-    case 23: //M23 - Select file
-      starpos = (strchr(strchr_pointer + 4,'*'));
-      if(starpos!=NULL)
-        *(starpos-1)='\0';
-      card.openFile(strchr_pointer + 4,true);
-      break;
-    case 24: //M24 - Start SD print
-      card.startFileprint();
-      starttime=millis();
-      break;
-    case 25: //M25 - Pause SD print
-      card.pauseSDPrint();
-      break;
-    case 26: //M26 - Set SD index
-      if(card.cardOK && code_seen('S')) {
-        card.setIndex(code_value_long());
+    enable_endstops(true);
+
+    for(int8_t i=0; i < NUM_AXIS; i++) {
+      destination[i] = current_position[i];
+    }
+    feedrate = 0.0;
+    home_all_axis = !((code_seen(axis_codes[0])) || (code_seen(axis_codes[1])) || (code_seen(axis_codes[2])));
+
+    #if Z_HOME_DIR > 0                      // If homing away from BED do Z first
+    if((home_all_axis) || (code_seen(axis_codes[RZ_AXIS]))) {
+      HOMEAXIS(Z);
+    }
+    #endif
+
+    #ifdef QUICK_HOME
+    if((home_all_axis)||( code_seen(axis_codes[X_AXIS]) && code_seen(axis_codes[Y_AXIS])) )  //first diagonal move
+    {
+      current_position[X_AXIS] = 0;current_position[Y_AXIS] = 0;
+
+      plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS], current_position[LZ_AXIS]);
+      destination[X_AXIS] = 1.5 * X_MAX_LENGTH * X_HOME_DIR;destination[Y_AXIS] = 1.5 * Y_MAX_LENGTH * Y_HOME_DIR;
+      feedrate = homing_feedrate[X_AXIS];
+      if(homing_feedrate[Y_AXIS]<feedrate)
+        feedrate =homing_feedrate[Y_AXIS];
+        plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[RZ_AXIS], destination[LZ_AXIS], feedrate/60, active_extruder);
+        st_synchronize();
+
+        axis_is_at_home(X_AXIS);
+        axis_is_at_home(Y_AXIS);
+        plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS], current_position[LZ_AXIS]);
+        destination[X_AXIS] = current_position[X_AXIS];
+        destination[Y_AXIS] = current_position[Y_AXIS];
+        plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[RZ_AXIS], destination[LZ_AXIS], feedrate/60, active_extruder);
+        feedrate = 0.0;
+        st_synchronize();
+        endstops_hit_on_purpose();
+    }
+    #endif
+
+    if((home_all_axis) || (code_seen(axis_codes[X_AXIS])))
+    {
+        HOMEAXIS(X);
+    }
+
+    if((home_all_axis) || (code_seen(axis_codes[Y_AXIS]))) {
+      HOMEAXIS(Y);
+    }
+
+    #if Z_HOME_DIR < 0                      // If homing towards BED do Z last
+      if((home_all_axis) || (code_seen(axis_codes[RZ_AXIS]))) {
+      HOMEAXIS(RZ);
+    }
+    #endif
+
+    if(code_seen(axis_codes[X_AXIS]))
+    {
+      if(code_value_long() != 0) {
+      current_position[X_AXIS]=code_value()+add_homeing[0];
       }
-      break;
-    case 27: //M27 - Get SD status
-      card.getStatus();
-      break;
-    case 28: //M28 - Start SD write
-      starpos = (strchr(strchr_pointer + 4,'*'));
-      if(starpos != NULL){
-        char* npos = strchr(cmdbuffer[bufindr], 'N');
-        strchr_pointer = strchr(npos,' ') + 1;
-        *(starpos-1) = '\0';
+    }
+
+    if(code_seen(axis_codes[Y_AXIS])) {
+      if(code_value_long() != 0) {
+        current_position[Y_AXIS]=code_value()+add_homeing[1];
       }
-      card.openFile(strchr_pointer+4,false);
-      break;
-    case 29: //M29 - Stop SD write
-      //processed in write to file routine above
-      //card,saving = false;
-      break;
-    case 30: //M30 <filename> Delete File 
-	if (card.cardOK){
-		card.closefile();
-		starpos = (strchr(strchr_pointer + 4,'*'));
-                if(starpos != NULL){
-                char* npos = strchr(cmdbuffer[bufindr], 'N');
-                strchr_pointer = strchr(npos,' ') + 1;
-                *(starpos-1) = '\0';
-         }
-	 card.removeFile(strchr_pointer + 4);
-	}
-	break;
-	
-#endif //SDSUPPORT
+    }
 
-    case 31: //M31 take time since the start of the SD print or an M109 command
-      {
-      stoptime=millis();
-      char time[30];
-      unsigned long t=(stoptime-starttime)/1000;
-      int sec,min;
-      min=t/60;
-      sec=t%60;
-      sprintf(time,"%i min, %i sec",min,sec);
-      SERIAL_ECHO_START;
-      SERIAL_ECHOLN(time);
+    if(code_seen(axis_codes[RZ_AXIS])) {
+      if(code_value_long() != 0) {
+        current_position[RZ_AXIS]=code_value()+add_homeing[2];
       }
-      break;
-    case 42: //M42 -Change pin status via gcode
-      if (code_seen('S'))
-      {
-        int pin_status = code_value();
-        if (code_seen('P') && pin_status >= 0 && pin_status <= 255)
-        {
-          int pin_number = code_value();
-          for(int8_t i = 0; i < (int8_t)sizeof(sensitive_pins); i++)
-          {
-            if (sensitive_pins[i] == pin_number)
-            {
-              pin_number = -1;
-              break;
-            }
-          }
-          
-          if (pin_number > -1)
-          {              
-            pinMode(pin_number, OUTPUT);
-            digitalWrite(pin_number, pin_status);
-            analogWrite(pin_number, pin_status);
-          }
-        }
-      }
-     break;
+    }
+    plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS], current_position[LZ_AXIS]);
 
-    #if LASER_PIN > -1
-      case 600: //M600 Laser On
-        if (code_seen('S')){
-           LaserPower=constrain(code_value(),0,255);
-        }
-        else {
-          LaserPower=255;			
+    #ifdef ENDSTOPS_ONLY_FOR_HOMING
+      enable_endstops(false);
+    #endif
+
+    feedrate = saved_feedrate;
+    feedmultiply = saved_feedmultiply;
+    previous_millis_cmd = millis();
+    endstops_hit_on_purpose();
+  }
+
+  static void gcode_G90() // G90
+  {
+    relative_mode = false;
+  }
+
+  static void gcode_G91() // G91
+  {
+    relative_mode = true;
+  }
+
+  static void gcode_G92() // G92
+  {
+    st_synchronize();
+    for(int8_t i=0; i < NUM_AXIS; i++) {
+      if(code_seen(axis_codes[i])) {
+        if(i == LZ_AXIS)
+        {
+          current_position[i] = code_value()+add_homeing[2];
         }
-        break;
-      case 601: //601 Laser Off
-        LaserPower = 0;
-        break;
-      case 602: // Galvo Debug
-        break;
-    #endif //LASER_PIN
-    
-    #if FAN_PIN > -1
-      case 106: //M106 Fan On
-        if (code_seen('S')){
-           FanSpeed=constrain(code_value(),0,255);
+        else
+        {
+          current_position[i] = code_value()+add_homeing[i];
         }
-        else {
-          FanSpeed=255;			
+      plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS], current_position[LZ_AXIS]);
+      }
+    }
+  }
+
+  static void gcode_M17() // M17
+  {
+    enable_x();
+    enable_y();
+    enable_rz();
+    enable_lz();
+  }
+
+  #ifdef SDSUPPORT
+  static void gcode_M20() // M20 - list SD card
+  {
+    SERIAL_PROTOCOLLNPGM(MSG_BEGIN_FILE_LIST);
+    card.ls();
+    SERIAL_PROTOCOLLNPGM(MSG_END_FILE_LIST);
+  }
+
+  static void gcode_M21() // M21 - init SD card
+  {
+
+    card.initsd();
+
+  }
+
+  static void gcode_M22() // M22 - release SD card
+  {
+    card.release();
+
+  }
+
+  static void gcode_M23() // M23 - Select file
+  {
+    card.openFile(command_text(),true);
+  }
+
+  static void gcode_M24() // M24 - Start SD print
+  {
+    card.startFileprint();
+    #ifdef SD_BINARY_JOB
+    if(card.binaryJob)
+      bin_job_start();
+    #endif
+    starttime=millis();
+  }
+
+  static void gcode_M25() // M25 - Pause SD print
+  {
+    card.pauseSDPrint();
+  }
+
+  static void gcode_M26() // M26 - Set SD index
+  {
+    if(card.cardOK && code_seen('S')) {
+      card.setIndex(code_value_long());
+    }
+    #ifdef SD_BINARY_JOB
+    else if(card.cardOK && card.binaryJob && code_seen('L')) {
+      bin_job_seek_layer(code_value_long());
+    }
+    #endif
+  }
+
+  static void gcode_M27() // M27 - Get SD status
+  {
+    card.getStatus();
+    #ifdef SD_BINARY_JOB
+    if(card.cardOK && card.binaryJob)
+      bin_job_status();
+    #endif
+  }
+
+  #ifdef SD_BINARY_UPLOAD
+  // The host sends the bytes after "Writing to file", up to 512 at a time: every full block is
+  // answered with "ok", the host sends the next one after that. The serial buffer never fills
+  // while the card writes. Ends after the last byte, or when nothing comes for 5 seconds.
+  static void upload_binary(unsigned long size)
+  {
+    unsigned long received = 0;
+    unsigned long last = millis();
+    uint8_t chunk[16];
+    uint8_t n = 0;
+    while(received < size) {
+      if(MYSERIAL.available() > 0) {
+        chunk[n++] = MYSERIAL.read();
+        received++;
+        last = millis();
+        if(n == sizeof(chunk) || (received & 511) == 0 || received == size) {
+          card.write_data(chunk, n);
+          n = 0;
         }
+        if((received & 511) == 0 && received < size)
+          SERIAL_PROTOCOLLNPGM(MSG_OK);
+      }
+      else if(millis() - last > 5000) {
+        SERIAL_ERROR_START;
+        SERIAL_ERRORLNPGM("Upload timed out");
         break;
-      case 107: //M107 Fan Off
-        FanSpeed = 0;
-        break;
-    #endif //FAN_PIN
-    
-    #if (PS_ON_PIN > -1)
-      case 80: // M80 - ATX Power On
-        SET_OUTPUT(PS_ON_PIN); //GND
-        WRITE(PS_ON_PIN, LOW);
-        break;
-      #endif
-      
-      case 81: // M81 - ATX Power Off
-      
-      #if defined SUICIDE_PIN && SUICIDE_PIN > -1
-        st_synchronize();
-        suicide();
-      #elif (PS_ON_PIN > -1)
-        SET_OUTPUT(PS_ON_PIN); 
-        WRITE(PS_ON_PIN, HIGH);
-      #endif
-		break;
-        
-    case 82:
-      axis_relative_modes[3] = false;
-      break;
-    case 83:
-      axis_relative_modes[3] = true;
-      break;
-    case 18: //compatibility
-    case 84: // M84
-      if(code_seen('S')){ 
-        stepper_inactive_time = code_value() * 1000; 
       }
       else
-      { 
-        bool all_axis = !((code_seen(axis_codes[0])) || (code_seen(axis_codes[1])) || (code_seen(axis_codes[2]))|| (code_seen(axis_codes[3])));
-        if(all_axis)
+        manage_inactivity();
+    }
+    card.closefile();
+    SERIAL_PROTOCOLLNPGM(MSG_FILE_SAVED);
+  }
+  #endif
+
+  static void gcode_M28() // M28 - Start SD write
+  {
+    char *name = command_text();
+    #ifdef SD_BINARY_UPLOAD
+      if(name[0] == 'B' && isdigit(name[1])) {
+        unsigned long size = strtoul(name + 1, &name, 10);
+        while(*name == ' ') name++;
+        card.openFile(name,false);
+        if(card.saving)
+          upload_binary(size);
+        return;
+      }
+    #endif
+    card.openFile(name,false);
+  }
+
+  static void gcode_M29() // M29 - Stop SD write
+  {
+    //processed in write to file routine above
+    //card,saving = false;
+  }
+
+  static void gcode_M30() // M30 <filename> Delete File
+  {
+    if (card.cardOK){
+      card.closefile();
+      card.removeFile(command_text());
+    }
+  }
+  #endif
+
+  static void gcode_M31() // M31 take time since the start of the SD print or an M109 command
+  {
+    stoptime=millis();
+    char time[30];
+    unsigned long t=(stoptime-starttime)/1000;
+    int sec,min;
+    min=t/60;
+    sec=t%60;
+    sprintf(time,"%i min, %i sec",min,sec);
+    SERIAL_ECHO_START;
+    SERIAL_ECHOLN(time);
+  }
+
+  static void gcode_M42() // M42 -Change pin status via gcode
+  {
+    if (code_seen('S'))
+    {
+      int pin_status = code_value();
+      if (code_seen('P') && pin_status >= 0 && pin_status <= 255)
+      {
+        int pin_number = code_value();
+        for(int8_t i = 0; i < (int8_t)sizeof(sensitive_pins); i++)
         {
-          st_synchronize();
-          disable_lz();
-          finishAndDisableSteppers();
+          if (sensitive_pins[i] == pin_number)
+          {
+            pin_number = -1;
+            break;
+          }
         }
-        else
+
+        if (pin_number > -1)
         {
-          st_synchronize();
-          if(code_seen('X')) disable_x();
-          if(code_seen('Y')) disable_y();
-          if(code_seen('Z')) disable_rz();
-          #if ((LZ_ENABLE_PIN != X_ENABLE_PIN) && (E1_ENABLE_PIN != Y_ENABLE_PIN)) // Only enable on boards that have seperate ENABLE_PINS
-            if(code_seen('E')) {
-              disable_lz();
-            }
-          #endif 
+          pinMode(pin_number, OUTPUT);
+          digitalWrite(pin_number, pin_status);
+          analogWrite(pin_number, pin_status);
         }
       }
-      break;
-    case 85: // M85
-      code_seen('S');
-      max_inactive_time = code_value() * 1000; 
-      break;
-    case 92: // M92
-      for(int8_t i=0; i < NUM_AXIS; i++) 
+    }
+  }
+
+  #if PS_ON_PIN > -1
+  static void gcode_M80() // M80 - ATX Power On
+  {
+    SET_OUTPUT(PS_ON_PIN); //GND
+    WRITE(PS_ON_PIN, LOW);
+  }
+  #endif
+
+  static void gcode_M81() // M81 - ATX Power Off
+  {
+    #if defined SUICIDE_PIN && SUICIDE_PIN > -1
+      st_synchronize();
+      suicide();
+    #elif (PS_ON_PIN > -1)
+      SET_OUTPUT(PS_ON_PIN);
+      WRITE(PS_ON_PIN, HIGH);
+    #endif
+  }
+
+  static void gcode_M82() // M82
+  {
+    axis_relative_modes[3] = false;
+  }
+
+  static void gcode_M83() // M83
+  {
+    axis_relative_modes[3] = true;
+  }
+
+  static void gcode_M84() // M84, M18 for compatibility
+  {
+    if(code_seen('S')){
+      stepper_inactive_time = code_value() * 1000;
+    }
+    else
+    {
+      bool all_axis = !((code_seen(axis_codes[0])) || (code_seen(axis_codes[1])) || (code_seen(axis_codes[2]))|| (code_seen(axis_codes[3])));
+      if(all_axis)
       {
-        if(code_seen(axis_codes[i])) 
-        {
-            axis_steps_per_unit[i] = code_value();
-        }
+        st_synchronize();
+        disable_lz();
+        finishAndDisableSteppers();
       }
-      break;
-    case 115: // M115
-      SerialprintPGM(MSG_M115_REPORT);
-      break;
-    case 117: // M117 display message
-      break;
-    case 114: // M114
-      SERIAL_PROTOCOLPGM("X:");
-      SERIAL_PROTOCOL(current_position[X_AXIS]);
-      SERIAL_PROTOCOLPGM("Y:");
-      SERIAL_PROTOCOL(current_position[Y_AXIS]);
-      SERIAL_PROTOCOLPGM("RZ:");
-      SERIAL_PROTOCOL(current_position[RZ_AXIS]);
-      SERIAL_PROTOCOLPGM("LZ:");      
-      SERIAL_PROTOCOL(current_position[LZ_AXIS]);
-      
-      SERIAL_PROTOCOLPGM(MSG_COUNT_X);
-      SERIAL_PROTOCOL(float(st_get_position(X_AXIS))/axis_steps_per_unit[X_AXIS]);
-      SERIAL_PROTOCOLPGM("Y:");
-      SERIAL_PROTOCOL(float(st_get_position(Y_AXIS))/axis_steps_per_unit[Y_AXIS]);
-      SERIAL_PROTOCOLPGM("RZ:");
-      SERIAL_PROTOCOL(float(st_get_position(RZ_AXIS))/axis_steps_per_unit[RZ_AXIS]);
-      SERIAL_PROTOCOLPGM("LZ:");
-      SERIAL_PROTOCOL(float(st_get_position(LZ_AXIS))/axis_steps_per_unit[LZ_AXIS]);
-      
-      SERIAL_PROTOCOLLN("");
-      break;
-    case 120: // M120
-      enable_endstops(false) ;
-      break;
-    case 121: // M121
-      enable_endstops(true) ;
-      break;
-    case 119: // M119
+      else
+      {
+        st_synchronize();
+        if(code_seen('X')) disable_x();
+        if(code_seen('Y')) disable_y();
+        if(code_seen('Z')) disable_rz();
+        #if ((LZ_ENABLE_PIN != X_ENABLE_PIN) && (E1_ENABLE_PIN != Y_ENABLE_PIN)) // Only enable on boards that have seperate ENABLE_PINS
+          if(code_seen('E')) {
+            disable_lz();
+          }
+        #endif
+      }
+    }
+  }
+
+  static void gcode_M85() // M85
+  {
+    code_seen('S');
+    max_inactive_time = code_value() * 1000;
+  }
+
+  static void gcode_M92() // M92
+  {
+    for(int8_t i=0; i < NUM_AXIS; i++)
+    {
+      if(code_seen(axis_codes[i]))
+      {
+          axis_steps_per_unit[i] = code_value();
+      }
+    }
+  }
+
+  #if FAN_PIN > -1
+  static void gcode_M106() // M106 Fan On
+  {
+    if (code_seen('S')){
+       FanSpeed=constrain(code_value(),0,255);
+    }
+    else {
+      FanSpeed=255;
+    }
+  }
+
+  static void gcode_M107() // M107 Fan Off
+  {
+    FanSpeed = 0;
+  }
+  #endif
+
+  static void gcode_M114() // M114
+  {
+    SERIAL_PROTOCOLPGM("X:");
+    SERIAL_PROTOCOL(current_position[X_AXIS]);
+    SERIAL_PROTOCOLPGM("Y:");
+    SERIAL_PROTOCOL(current_position[Y_AXIS]);
+    SERIAL_PROTOCOLPGM("RZ:");
+    SERIAL_PROTOCOL(current_position[RZ_AXIS]);
+    SERIAL_PROTOCOLPGM("LZ:");
+    SERIAL_PROTOCOL(current_position[LZ_AXIS]);
+
+    SERIAL_PROTOCOLPGM(MSG_COUNT_X);
+    SERIAL_PROTOCOL(float(st_get_position(X_AXIS))/axis_steps_per_unit[X_AXIS]);
+    SERIAL_PROTOCOLPGM("Y:");
+    SERIAL_PROTOCOL(float(st_get_position(Y_AXIS))/axis_steps_per_unit[Y_AXIS]);
+    SERIAL_PROTOCOLPGM("RZ:");
+    SERIAL_PROTOCOL(float(st_get_position(RZ_AXIS))/axis_steps_per_unit[RZ_AXIS]);
+    SERIAL_PROTOCOLPGM("LZ:");
+    SERIAL_PROTOCOL(float(st_get_position(LZ_AXIS))/axis_steps_per_unit[LZ_AXIS]);
+
+    SERIAL_PROTOCOLLN("");
+  }
+
+  static void gcode_M115() // M115
+  {
+    SerialprintPGM(MSG_M115_REPORT);
+  }
+
+  static void gcode_M119() // M119
+  {
     SERIAL_PROTOCOLLN(MSG_M119_REPORT);
       #if (X_MIN_PIN > -1)
         SERIAL_PROTOCOLPGM(MSG_X_MIN);
@@ -1134,167 +1626,264 @@ extern "C++"
         SERIAL_PROTOCOLPGM(MSG_Z_MAX);
         SERIAL_PROTOCOLLN(((READ(Z_MAX_PIN)^Z_ENDSTOPS_INVERTING)?MSG_ENDSTOP_HIT:MSG_ENDSTOP_OPEN));
       #endif
-      break;
-      //TODO: update for all axis, use for loop
-    case 201: // M201
-      for(int8_t i=0; i < NUM_AXIS; i++) 
-      {
-        if(code_seen(axis_codes[i]))
-        {
-          max_acceleration_units_per_sq_second[i] = code_value();
-          axis_steps_per_sqr_second[i] = code_value() * axis_steps_per_unit[i];
-        }
-      }
-      break;
-    #if 0 // Not used for Sprinter/grbl gen6
-    case 202: // M202
-      for(int8_t i=0; i < NUM_AXIS; i++) {
-        if(code_seen(axis_codes[i])) axis_travel_steps_per_sqr_second[i] = code_value() * axis_steps_per_unit[i];
-      }
-      break;
-    #endif
-    case 203: // M203 max feedrate mm/sec
-      for(int8_t i=0; i < NUM_AXIS; i++) {
-        if(code_seen(axis_codes[i])) max_feedrate[i] = code_value();
-      }
-      break;
-    case 204: // M204 acclereration S normal moves T filmanent only moves
-      {
-        if(code_seen('S')) acceleration = code_value() ;
-        if(code_seen('T')) retract_acceleration = code_value() ;
-      }
-      break;
-    case 205: //M205 advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk
-    {
-      if(code_seen('S')) minimumfeedrate = code_value();
-      if(code_seen('T')) mintravelfeedrate = code_value();
-      if(code_seen('B')) minsegmenttime = code_value() ;
-      if(code_seen('X')) max_xy_jerk = code_value() ;
-      if(code_seen('Z')) { max_z_jerk = code_value() ;  max_e_jerk = max_z_jerk;}
-      if(code_seen('E')) max_e_jerk = code_value() ;
-    }
-    break;
-    case 206: // M206 additional homeing offset
-      for(int8_t i=0; i < 3; i++) 
-      {
-        if(code_seen(axis_codes[i])) add_homeing[i] = code_value();
-      }
-      break;
-    #ifdef FWRETRACT
-    case 207: //M207 - set retract length S[positive mm] F[feedrate mm/sec] Z[additional zlift/hop]
+  }
+
+  static void gcode_M120() // M120
+  {
+    enable_endstops(false) ;
+  }
+
+  static void gcode_M121() // M121
+  {
+    enable_endstops(true) ;
+  }
+
+  static void gcode_M201() // M201
+  {
+    for(int8_t i=0; i < NUM_AXIS; i++)
     {
-      if(code_seen('S')) 
-      {
-        retract_length = code_value() ;
-      }
-      if(code_seen('F')) 
-      {
-        retract_feedrate = code_value() ;
-      }
-      if(code_seen('Z')) 
+      if(code_seen(axis_codes[i]))
       {
-        retract_zlift = code_value() ;
+        max_acceleration_units_per_sq_second[i] = code_value();
+        axis_steps_per_sqr_second[i] = code_value() * axis_steps_per_unit[i];
       }
-    }break;
-    case 208: // M208 - set retract recover length S[positive mm surplus to the M207 S*] F[feedrate mm/sec]
+    }
+  }
+
+  static void gcode_M203() // M203 max feedrate mm/sec
+  {
+    for(int8_t i=0; i < NUM_AXIS; i++) {
+      if(code_seen(axis_codes[i])) max_feedrate[i] = code_value();
+    }
+  }
+
+  static void gcode_M204() // M204 acclereration S normal moves T filmanent only moves
+  {
+    if(code_seen('S')) acceleration = code_value() ;
+    if(code_seen('T')) retract_acceleration = code_value() ;
+  }
+
+  static void gcode_M205() // M205 advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk
+  {
+    if(code_seen('S')) minimumfeedrate = code_value();
+    if(code_seen('T')) mintravelfeedrate = code_value();
+    if(code_seen('B')) minsegmenttime = code_value() ;
+    if(code_seen('X')) max_xy_jerk = code_value() ;
+    if(code_seen('Z')) { max_z_jerk = code_value() ;  max_e_jerk = max_z_jerk;}
+    if(code_seen('E')) max_e_jerk = code_value() ;
+  }
+
+  static void gcode_M206() // M206 additional homeing offset
+  {
+    for(int8_t i=0; i < 3; i++)
     {
-      if(code_seen('S')) 
-      {
-        retract_recover_length = code_value() ;
-      }
-      if(code_seen('F')) 
-      {
-        retract_recover_feedrate = code_value() ;
-      }
-    }break;
-    
-    case 209: // M209 - S<1=true/0=false> enable automatic retract detect if the slicer did not support G10/11: every normal extrude-only move will be classified as retract depending on the direction.
+      if(code_seen(axis_codes[i])) add_homeing[i] = code_value();
+    }
+  }
+
+  #ifdef FWRETRACT
+  static void gcode_M207() // M207 - set retract length S[positive mm] F[feedrate mm/sec] Z[additional zlift/hop]
+  {
+    if(code_seen('S'))
     {
-      if(code_seen('S')) 
-      {
-        int t= code_value() ;
-        switch(t)
-        {
-          case 0: autoretract_enabled=false;retracted=false;break;
-          case 1: autoretract_enabled=true;retracted=false;break;
-          default: 
-            SERIAL_ECHO_START;
-            SERIAL_ECHOPGM(MSG_UNKNOWN_COMMAND);
-            SERIAL_ECHO(cmdbuffer[bufindr]);
-            SERIAL_ECHOLNPGM("\"");
-        }
-      }
-      
-    }break;
-    #endif
-    case 220: // M220 S<factor in percent>- set speed factor override percentage
+      retract_length = code_value() ;
+    }
+    if(code_seen('F'))
     {
-      if(code_seen('S')) 
-      {
-        feedmultiply = code_value() ;
-        feedmultiplychanged=true;
-      }
+      retract_feedrate = code_value() ;
     }
-    break;
-
-    case 240: // M240  Triggers a camera by emulating a Canon RC-1 : http://www.doc-diy.net/photo/rc-1_hacked/
-     {
-      #ifdef PHOTOGRAPH_PIN
-        #if (PHOTOGRAPH_PIN > -1)
-        const uint8_t NUM_PULSES=16;
-        const float PULSE_LENGTH=0.01524;
-        for(int i=0; i < NUM_PULSES; i++) {
-          WRITE(PHOTOGRAPH_PIN, HIGH);
-          _delay_ms(PULSE_LENGTH);
-          WRITE(PHOTOGRAPH_PIN, LOW);
-          _delay_ms(PULSE_LENGTH);
-        }
-        delay(7.33);
-        for(int i=0; i < NUM_PULSES; i++) {
-          WRITE(PHOTOGRAPH_PIN, HIGH);
-          _delay_ms(PULSE_LENGTH);
-          WRITE(PHOTOGRAPH_PIN, LOW);
-          _delay_ms(PULSE_LENGTH);
-        }
-        #endif
-      #endif
-     }
-    break;
-      
-    case 400: // M400 finish all moves
+    if(code_seen('Z'))
     {
-      st_synchronize();
+      retract_zlift = code_value() ;
     }
-    break;
-    case 500: // Store settings in EEPROM
+  }
+
+  static void gcode_M208() // M208 - set retract recover length S[positive mm surplus to the M207 S*] F[feedrate mm/sec]
+  {
+    if(code_seen('S'))
     {
-        EEPROM_StoreSettings();
+      retract_recover_length = code_value() ;
     }
-    break;
-    case 501: // Read settings from EEPROM
+    if(code_seen('F'))
     {
-      EEPROM_RetrieveSettings();
+      retract_recover_feedrate = code_value() ;
     }
-    break;
-    case 502: // Revert to default settings
+  }
+
+  static void gcode_M209() // M209 - S<1=true/0=false> enable automatic retract detect if the slicer did not support G10/11: every normal extrude-only move will be classified as retract depending on the direction.
+  {
+    if(code_seen('S'))
     {
-      EEPROM_RetrieveSettings(true);
+      int t= code_value() ;
+      switch(t)
+      {
+        case 0: autoretract_enabled=false;retracted=false;break;
+        case 1: autoretract_enabled=true;retracted=false;break;
+        default:
+          SERIAL_ECHO_START;
+          SERIAL_ECHOPGM(MSG_UNKNOWN_COMMAND);
+          SERIAL_ECHO(CMD_CURRENT);
+          SERIAL_ECHOLNPGM("\"");
+      }
     }
-    break;
-    case 503: // print settings currently in memory
+
+  }
+  #endif
+
+  static void gcode_M220() // M220 S<factor in percent>- set speed factor override percentage
+  {
+    if(code_seen('S'))
     {
-      EEPROM_printSettings();
+      feedmultiply = code_value() ;
+      feedmultiplychanged=true;
     }
-    break;
-    case 999: // Restart after being stopped
-      Stopped = false;
-      gcode_LastN = Stopped_gcode_LastN;
-      FlushSerialRequestResend();
-    break;
+  }
+
+  static void gcode_M240() // M240  Triggers a camera by emulating a Canon RC-1 : http://www.doc-diy.net/photo/rc-1_hacked/
+  {
+    #ifdef PHOTOGRAPH_PIN
+      #if (PHOTOGRAPH_PIN > -1)
+      const uint8_t NUM_PULSES=16;
+      const float PULSE_LENGTH=0.01524;
+      for(int i=0; i < NUM_PULSES; i++) {
+        WRITE(PHOTOGRAPH_PIN, HIGH);
+        _delay_ms(PULSE_LENGTH);
+        WRITE(PHOTOGRAPH_PIN, LOW);
+        _delay_ms(PULSE_LENGTH);
+      }
+      delay(7.33);
+      for(int i=0; i < NUM_PULSES; i++) {
+        WRITE(PHOTOGRAPH_PIN, HIGH);
+        _delay_ms(PULSE_LENGTH);
+        WRITE(PHOTOGRAPH_PIN, LOW);
+        _delay_ms(PULSE_LENGTH);
+      }
+      #endif
+    #endif
+  }
+
+  static void gcode_M400() // M400 finish all moves
+  {
+    st_synchronize();
+  }
+
+  static void gcode_M500() // M500 Store settings in EEPROM
+  {
+    EEPROM_StoreSettings();
+  }
+
+  static void gcode_M501() // M501 Read settings from EEPROM
+  {
+    EEPROM_RetrieveSettings();
+  }
+
+  static void gcode_M502() // M502 Revert to default settings
+  {
+    EEPROM_RetrieveSettings(true);
+  }
+
+  static void gcode_M503() // M503 print settings currently in memory
+  {
+    EEPROM_printSettings();
+  }
+
+  #if LASER_PIN > -1
+  static void gcode_M600() // M600 Laser On
+  {
+    if (code_seen('S')){
+       LaserPower=constrain(code_value(),0,255);
+    }
+    else {
+      LaserPower=255;
     }
+    plan_set_idle_laser_power();
   }
 
-  else if(code_seen('T')) 
+  static void gcode_M601() // M601 Laser Off
+  {
+    LaserPower = 0;
+    plan_set_idle_laser_power();
+  }
+  #endif
+
+  #ifdef STEPPER_ISR_PROFILE
+  static void gcode_M603() // M603 report stepper ISR profile, M603 R clears it
+  {
+    if(code_seen('R'))
+      st_profile_reset();
+    else
+      st_profile_report();
+  }
+  #endif
+
+  #if LASER_PIN > -1
+  static void gcode_M604() // M604 laser power of G0/G1 S for that move only (S1) or until changed (S0)
+  {
+    if(code_seen('S'))
+      laser_per_move = (code_value() != 0);
+  }
+  #endif
+
+  static void gcode_M605() // M605 report serial line counters, M605 R clears them
+  {
+    if(code_seen('R')) {
+      serial_stats.lines = 0;
+      serial_stats.resends = 0;
+      #if !defined(__AVR_AT90USB1286__) && !defined(__AVR_AT90USB1287__)
+        MYSERIAL.clearRxOverflows();
+      #endif
+      return;
+    }
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPGM("Serial lines:");
+    SERIAL_ECHO(serial_stats.lines);
+    SERIAL_ECHOPGM(" resends:");
+    SERIAL_ECHO(serial_stats.resends);
+    #if !defined(__AVR_AT90USB1286__) && !defined(__AVR_AT90USB1287__)
+      SERIAL_ECHOPGM(" rx overflows:");
+      SERIAL_ECHO(MYSERIAL.rxOverflows());
+    #endif
+    SERIAL_ECHOLN("");
+  }
+
+  #ifdef BINARY_PROTOCOL
+  static void gcode_M610() // M610 switch to binary move frames, the host waits for this ok before sending them
+  {
+    bin_begin();
+  }
+  #endif
+
+  #ifdef MACROS
+  static void gcode_M710() // M710 P<slot> record the following commands until M711
+  {
+    if(code_seen('P') && code_value() >= 0 && code_value() < MACRO_SLOTS)
+      macro_begin((uint8_t)code_value());
+    else {
+      SERIAL_ERROR_START;
+      SERIAL_ERRORLNPGM("Invalid macro slot");
+    }
+  }
+
+  static void gcode_M712() // M712 P<slot> run a macro
+  {
+    if(code_seen('P') && code_value() >= 0 && code_value() < MACRO_SLOTS)
+      macro_play((uint8_t)code_value());
+    else {
+      SERIAL_ERROR_START;
+      SERIAL_ERRORLNPGM("Invalid macro slot");
+    }
+  }
+  #endif
+
+  static void gcode_M999() // M999 Restart after being stopped
+  {
+    Stopped = false;
+    gcode_LastN = Stopped_gcode_LastN;
+    FlushSerialRequestResend();
+  }
+
+
+  static void gcode_T()
   {
     tmp_extruder = code_value();
     if(tmp_extruder >= EXTRUDERS) {
@@ -1310,15 +1899,183 @@ extern "C++"
       SERIAL_PROTOCOLLN((int)active_extruder);
     }
   }
+}
 
-  else
+// Handlers of the G and M codes, sorted by COMMAND_KEY for the binary search in find_command().
+// Codes that are not listed are acknowledged without doing anything. G0-G3 never get here.
+#define COMMAND_KEY(letter, number) ((((letter) == 'M') ? 0x8000 : 0) | (number))
+typedef void (*command_handler_t)();
+extern "C++" { static void gcode_M606(); } // Times the table, so it comes after it
+typedef struct {
+  uint16_t key;
+  command_handler_t handler;
+} command_t;
+static const command_t commands[] PROGMEM = {
+  { COMMAND_KEY('G', 4), gcode_G4 },
+#ifdef FWRETRACT
+  { COMMAND_KEY('G', 10), gcode_G10 },
+  { COMMAND_KEY('G', 11), gcode_G11 },
+#endif
+  { COMMAND_KEY('G', 28), gcode_G28 },
+  { COMMAND_KEY('G', 90), gcode_G90 },
+  { COMMAND_KEY('G', 91), gcode_G91 },
+  { COMMAND_KEY('G', 92), gcode_G92 },
+  { COMMAND_KEY('M', 17), gcode_M17 },
+  { COMMAND_KEY('M', 18), gcode_M84 },
+#ifdef SDSUPPORT
+  { COMMAND_KEY('M', 20), gcode_M20 },
+  { COMMAND_KEY('M', 21), gcode_M21 },
+  { COMMAND_KEY('M', 22), gcode_M22 },
+  { COMMAND_KEY('M', 23), gcode_M23 },
+  { COMMAND_KEY('M', 24), gcode_M24 },
+  { COMMAND_KEY('M', 25), gcode_M25 },
+  { COMMAND_KEY('M', 26), gcode_M26 },
+  { COMMAND_KEY('M', 27), gcode_M27 },
+  { COMMAND_KEY('M', 28), gcode_M28 },
+  { COMMAND_KEY('M', 29), gcode_M29 },
+  { COMMAND_KEY('M', 30), gcode_M30 },
+#endif
+  { COMMAND_KEY('M', 31), gcode_M31 },
+  { COMMAND_KEY('M', 42), gcode_M42 },
+#if PS_ON_PIN > -1
+  { COMMAND_KEY('M', 80), gcode_M80 },
+#endif
+  { COMMAND_KEY('M', 81), gcode_M81 },
+  { COMMAND_KEY('M', 82), gcode_M82 },
+  { COMMAND_KEY('M', 83), gcode_M83 },
+  { COMMAND_KEY('M', 84), gcode_M84 },
+  { COMMAND_KEY('M', 85), gcode_M85 },
+  { COMMAND_KEY('M', 92), gcode_M92 },
+#if FAN_PIN > -1
+  { COMMAND_KEY('M', 106), gcode_M106 },
+  { COMMAND_KEY('M', 107), gcode_M107 },
+#endif
+  { COMMAND_KEY('M', 114), gcode_M114 },
+  { COMMAND_KEY('M', 115), gcode_M115 },
+  { COMMAND_KEY('M', 119), gcode_M119 },
+  { COMMAND_KEY('M', 120), gcode_M120 },
+  { COMMAND_KEY('M', 121), gcode_M121 },
+  { COMMAND_KEY('M', 201), gcode_M201 },
+  { COMMAND_KEY('M', 203), gcode_M203 },
+  { COMMAND_KEY('M', 204), gcode_M204 },
+  { COMMAND_KEY('M', 205), gcode_M205 },
+  { COMMAND_KEY('M', 206), gcode_M206 },
+#ifdef FWRETRACT
+  { COMMAND_KEY('M', 207), gcode_M207 },
+  { COMMAND_KEY('M', 208), gcode_M208 },
+  { COMMAND_KEY('M', 209), gcode_M209 },
+#endif
+  { COMMAND_KEY('M', 220), gcode_M220 },
+  { COMMAND_KEY('M', 240), gcode_M240 },
+  { COMMAND_KEY('M', 400), gcode_M400 },
+  { COMMAND_KEY('M', 500), gcode_M500 },
+  { COMMAND_KEY('M', 501), gcode_M501 },
+  { COMMAND_KEY('M', 502), gcode_M502 },
+  { COMMAND_KEY('M', 503), gcode_M503 },
+#if LASER_PIN > -1
+  { COMMAND_KEY('M', 600), gcode_M600 },
+  { COMMAND_KEY('M', 601), gcode_M601 },
+#endif
+#ifdef STEPPER_ISR_PROFILE
+  { COMMAND_KEY('M', 603), gcode_M603 },
+#endif
+#if LASER_PIN > -1
+  { COMMAND_KEY('M', 604), gcode_M604 },
+#endif
+  { COMMAND_KEY('M', 605), gcode_M605 },
+  { COMMAND_KEY('M', 606), gcode_M606 },
+#ifdef BINARY_PROTOCOL
+  { COMMAND_KEY('M', 610), gcode_M610 },
+#endif
+#ifdef MACROS
+  { COMMAND_KEY('M', 710), gcode_M710 },
+  { COMMAND_KEY('M', 712), gcode_M712 },
+#endif
+  { COMMAND_KEY('M', 999), gcode_M999 },
+};
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+extern "C++"
+{
+  command_handler_t find_command(uint16_t key)
+  {
+    uint8_t low = 0, high = COMMAND_COUNT;
+    while(low < high) {
+      uint8_t middle = (low + high) >> 1;
+      uint16_t middle_key = pgm_read_word(&commands[middle].key);
+      if(middle_key == key)
+        return (command_handler_t)pgm_read_word(&commands[middle].handler);
+      if(middle_key < key)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    return NULL;
+  }
+
+  static void gcode_M606() // M606 time find_command() over the whole table
   {
+    volatile command_handler_t found;
+    unsigned long start = micros();
+    for(uint8_t repeat = 0; repeat < 10; repeat++)
+      for(uint8_t i = 0; i < COMMAND_COUNT; i++)
+        found = find_command(pgm_read_word(&commands[i].key));
+    unsigned long elapsed = micros() - start;
+    (void)found;
     SERIAL_ECHO_START;
-    SERIAL_ECHOPGM(MSG_UNKNOWN_COMMAND);
-    SERIAL_ECHO(cmdbuffer[bufindr]);
-    SERIAL_ECHOLNPGM("\"");
+    SERIAL_ECHOPGM("Dispatch: ");
+    SERIAL_ECHO((int)COMMAND_COUNT);
+    SERIAL_ECHOPGM(" commands, us per lookup:");
+    SERIAL_ECHOLN((float)elapsed / (10 * COMMAND_COUNT));
   }
 
+  void process_commands()
+  {
+    parse_command(CMD_CURRENT);
+    #ifdef MACROS
+    if(macro_record())
+      return;
+    #endif
+    process_parsed();
+  }
+
+  void process_parsed()
+  {
+    if(parsed.command == 'G' && parsed.code >= 0 && parsed.code <= 3) {
+      // Moves are nearly all of a job, so they go first and skip the table. Their ok was
+      // sent by get_command() already.
+      if(Stopped == false) {
+        if(parsed.code <= 1) {
+          get_coordinates(); // For X Y Z E F
+          #if LASER_PIN > -1
+            prepare_laser_move();
+          #else
+            prepare_move();
+          #endif
+        }
+        else {
+          get_arc_coordinates();
+          prepare_arc_move(parsed.code == 2); // G2 CW, G3 CCW
+        }
+        return;
+      }
+    }
+    else if(parsed.command == 'G' || parsed.command == 'M') {
+      // A negative code would turn into the key of another command, it is not listed either
+      command_handler_t handler = (parsed.code >= 0) ? find_command(COMMAND_KEY(parsed.command, parsed.code)) : NULL;
+      if(handler != NULL)
+        handler();
+    }
+    else if(parsed.command == 'T') {
+      gcode_T();
+    }
+    else {
+      SERIAL_ECHO_START;
+      SERIAL_ECHOPGM(MSG_UNKNOWN_COMMAND);
+      SERIAL_ECHO(CMD_CURRENT);
+      SERIAL_ECHOLNPGM("\"");
+    }
+
     ClearToSend();
   }
 }
@@ -1327,10 +2084,11 @@ extern "C++"
 {
   void FlushSerialRequestResend()
   {
-    //char cmdbuffer[bufindr][100]="Resend:";
+    //char CMD_CURRENT[100]="Resend:";
     MYSERIAL.flush();
     SERIAL_PROTOCOLPGM(MSG_RESEND);
     SERIAL_PROTOCOLLN(gcode_LastN + 1);
+    serial_stats.resends++;
     ClearToSend();
   }
 }
@@ -1340,11 +2098,29 @@ extern "C++"
   void ClearToSend()
   {
     previous_millis_cmd = millis();
+    #ifdef MACROS
+      if(macro_playing)
+      return;
+    #endif
     #ifdef SDSUPPORT
-      if(fromsd[bufindr])
+      if(buflen > 0 && (cmdqueue[bufindr + CMD_FLAGS] & CMD_FROMSD))
       return;
     #endif //SDSUPPORT
-    SERIAL_PROTOCOLLNPGM(MSG_OK); 
+    serial_ok();
+  }
+
+  void serial_ok()
+  {
+    SERIAL_PROTOCOLPGM(MSG_OK);
+    #ifdef ADVANCED_OK
+      SERIAL_PROTOCOLPGM(" N");
+      SERIAL_PROTOCOL(gcode_LastN);
+      SERIAL_PROTOCOLPGM(" P");
+      SERIAL_PROTOCOL((int)(BLOCK_BUFFER_SIZE - 1 - movesplanned())); // One block always stays empty
+      SERIAL_PROTOCOLPGM(" B");
+      SERIAL_PROTOCOL(cmdqueue_free_lines());
+    #endif
+    MYSERIAL.write('\n');
   }
 }
 
@@ -1352,7 +2128,7 @@ extern "C++"
 {
   void get_coordinates()
   {
-    bool seen[4]={false,false,false,false};
+    bool seen[4] __attribute__((unused)) = {false,false,false,false}; // Only read with FWRETRACT
     //X, Y, (Z, E)
     for(int8_t i=0; i < 2; i++) {
       if(code_seen(axis_codes[i])) 
@@ -1475,6 +2251,25 @@ extern "C++"
 
 extern "C++"
 {
+  #if LASER_PIN > -1
+  // G0/G1 with the laser power going into the planner block, the stepper ISR switches it when
+  // the move starts. LaserPower stays the power used while the machine is idle.
+  void prepare_laser_move()
+  {
+    if(laser_per_move) {
+      unsigned char idle_power = LaserPower;
+      LaserPower = code_seen('S') ? constrain(code_value(),0,255) : 0;
+      prepare_move();
+      LaserPower = idle_power;
+    }
+    else {
+      if(code_seen('S'))
+        LaserPower = constrain(code_value(),0,255);
+      prepare_move();
+    }
+  }
+  #endif
+
   void prepare_move()
   {
     clamp_to_software_endstops(destination);
@@ -1492,6 +2287,29 @@ extern "C++"
       current_position[i] = destination[i];
     }
   }
+
+  // Move queued without going through the G-code parser (binary protocol).
+  // A feed rate of 0 keeps the current one. The laser power is handled like the S of G0/G1,
+  // see prepare_laser_move(); -1 is a move without one.
+  void prepare_binary_move(const float target[NUM_AXIS], float feed, int laser)
+  {
+    for(int8_t i=0; i < NUM_AXIS; i++) {
+      destination[i] = target[i];
+    }
+    if(feed > 0.0) feedrate = feed;
+    #if LASER_PIN > -1
+      unsigned char idle_power = LaserPower;
+      if(laser >= 0)
+        LaserPower = laser;
+      else if(laser_per_move)
+        LaserPower = 0;
+      prepare_move();
+      if(laser_per_move)
+        LaserPower = idle_power;
+    #else
+      prepare_move();
+    #endif
+  }
 }
 
 extern "C++"
@@ -1576,6 +2394,12 @@ extern "C++"
     #endif
   
     check_axes_activity();
+    #ifdef SDSUPPORT
+      card.prefetch();
+    #endif
+    #ifdef Z_POWER_MANAGEMENT
+      manage_z_power();
+    #endif
   }
 }
 
@@ -1593,6 +2417,13 @@ extern "C++"
     disable_rz();
     disable_lz();
 
+    #ifdef SDSUPPORT
+      if(card.saving)
+        card.closefile(); // Sends the stop token of an M28 upload, frees what it did not use
+    #endif
+    #if !defined(__AVR_AT90USB1286__) && !defined(__AVR_AT90USB1287__)
+      MYSERIAL.flushTx(); // The message is still in the TX ring, which needs interrupts
+    #endif
     cli(); // Stop interrupts
 
     if(PS_ON_PIN > -1) pinMode(PS_ON_PIN,INPUT);
@@ -29,12 +29,13 @@
 #if defined(UBRRH) || defined(UBRR0H) || defined(UBRR1H) || defined(UBRR2H) || defined(UBRR3H)
 
 #if defined(UBRRH) || defined(UBRR0H)
-  ring_buffer rx_buffer  =  { { 0 }, 0, 0 };
+  ring_buffer rx_buffer  =  { { 0 }, 0, 0, 0 };
+  tx_ring_buffer tx_buffer  =  { { 0 }, 0, 0 };
 #endif
 
 FORCE_INLINE void store_char(unsigned char c)
 {
-  int i = (unsigned int)(rx_buffer.head + 1) % RX_BUFFER_SIZE;
+  unsigned char i = (rx_buffer.head + 1) & (RX_BUFFER_SIZE - 1);
 
   // if we should be storing the received character into the location
   // just before the tail (meaning that the head would advance to the
@@ -44,6 +45,9 @@ FORCE_INLINE void store_char(unsigned char c)
     rx_buffer.buffer[rx_buffer.head] = c;
     rx_buffer.head = i;
   }
+  else {
+    rx_buffer.overflows++;
+  }
 }
 
 
@@ -54,6 +58,7 @@ FORCE_INLINE void store_char(unsigned char c)
   SIGNAL(USART0_RX_vect)
   {
   #if defined(UDR0)
+    if (UCSR0A & (1<<DOR0)) rx_buffer.overflows++; // a byte was lost in the USART itself
     unsigned char c  =  UDR0;
   #elif defined(UDR)
     unsigned char c  =  UDR;  //  atmega8, atmega32
@@ -64,6 +69,22 @@ FORCE_INLINE void store_char(unsigned char c)
   }
 #endif
 
+// Sends the next waiting character, the interrupt is switched off when none is left
+FORCE_INLINE void tx_udr_empty_irq(void)
+{
+  UDR0 = tx_buffer.buffer[tx_buffer.tail];
+  tx_buffer.tail = (tx_buffer.tail + 1) & (TX_BUFFER_SIZE - 1);
+  if (tx_buffer.head == tx_buffer.tail)
+    cbi(UCSR0B, UDRIE0);
+}
+
+#if defined(USART0_UDRE_vect)
+  SIGNAL(USART0_UDRE_vect)
+  {
+    tx_udr_empty_irq();
+  }
+#endif
+
 // Constructors ////////////////////////////////////////////////////////////////
 
 MarlinSerial::MarlinSerial()
@@ -99,9 +120,12 @@ void MarlinSerial::begin(long baud)
   UBRR0H = baud_setting >> 8;
   UBRR0L = baud_setting;
 
+  tx_buffer.head = tx_buffer.tail = 0;
+
   sbi(UCSR0B, RXEN0);
   sbi(UCSR0B, TXEN0);
   sbi(UCSR0B, RXCIE0);
+  cbi(UCSR0B, UDRIE0);
 }
 
 void MarlinSerial::end()
@@ -109,6 +133,43 @@ void MarlinSerial::end()
   cbi(UCSR0B, RXEN0);
   cbi(UCSR0B, TXEN0);
   cbi(UCSR0B, RXCIE0);  
+  cbi(UCSR0B, UDRIE0);
+}
+
+void MarlinSerial::write(uint8_t c)
+{
+  // Nothing waiting and the USART is free: skip the buffer and the interrupt
+  if (tx_buffer.head == tx_buffer.tail && (UCSR0A & (1 << UDRE0))) {
+    UDR0 = c;
+    return;
+  }
+
+  unsigned char i = (tx_buffer.head + 1) & (TX_BUFFER_SIZE - 1);
+  while (i == tx_buffer.tail) {
+    // Buffer full, wait for the interrupt to make room. With interrupts off (inside an ISR
+    // or a critical section) it never comes, so send a character here.
+    if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0)))
+      tx_udr_empty_irq();
+  }
+  tx_buffer.buffer[tx_buffer.head] = c;
+
+  // UCSR0B is outside the I/O space, so sbi() is a load, an or and a store. Were the UDRE
+  // interrupt to send the last character and clear UDRIE0 in between, the store would switch
+  // it back on with an empty ring, and it would send the whole stale ring.
+  unsigned char sreg = SREG;
+  cli();
+  tx_buffer.head = i;
+  sbi(UCSR0B, UDRIE0);
+  SREG = sreg;
+}
+
+void MarlinSerial::flushTx()
+{
+  while (tx_buffer.head != tx_buffer.tail) {
+    // Like write(): with interrupts off, send the characters here
+    if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0)))
+      tx_udr_empty_irq();
+  }
 }
 
 
@@ -129,7 +190,7 @@ int MarlinSerial::read(void)
     return -1;
   } else {
     unsigned char c = rx_buffer.buffer[rx_buffer.tail];
-    rx_buffer.tail = (unsigned int)(rx_buffer.tail + 1) % RX_BUFFER_SIZE;
+    rx_buffer.tail = (rx_buffer.tail + 1) & (RX_BUFFER_SIZE - 1);
     return c;
   }
 }
@@ -36,18 +36,34 @@
 // using a ring buffer (I think), in which rx_buffer_head is the index of the
 // location to which to write the next incoming character and rx_buffer_tail
 // is the index of the location from which to read.
-#define RX_BUFFER_SIZE 128
+// The RX buffer is only filled by the USART0_RX_vect interrupt. Its size must be a
+// power of 2 and no larger than 256, so the head/tail indices are single bytes and can be
+// read without a critical section.
+#define RX_BUFFER_SIZE 256
 
 
 struct ring_buffer
 {
   unsigned char buffer[RX_BUFFER_SIZE];
-  int head;
-  int tail;
+  volatile unsigned char head;
+  volatile unsigned char tail;
+  volatile unsigned int overflows; // characters lost because the buffer was full or the USART overran
+};
+
+// Outgoing characters wait here and are sent by the USART0_UDRE_vect interrupt, so printing
+// only stalls the caller once the buffer is full. Same size rules as RX_BUFFER_SIZE.
+#define TX_BUFFER_SIZE 128
+
+struct tx_ring_buffer
+{
+  unsigned char buffer[TX_BUFFER_SIZE];
+  volatile unsigned char head;
+  volatile unsigned char tail;
 };
 
 #if defined(UBRRH) || defined(UBRR0H)
   extern ring_buffer rx_buffer;
+  extern tx_ring_buffer tx_buffer;
 #endif
 
 class MarlinSerial //: public Stream
@@ -63,34 +79,35 @@ class MarlinSerial //: public Stream
     
     FORCE_INLINE int available(void)
     {
-      return (unsigned int)(RX_BUFFER_SIZE + rx_buffer.head - rx_buffer.tail) % RX_BUFFER_SIZE;
+      return (unsigned int)(RX_BUFFER_SIZE + rx_buffer.head - rx_buffer.tail) & (RX_BUFFER_SIZE - 1);
     }
-    
-    FORCE_INLINE void write(uint8_t c)
+
+    // Number of received characters dropped since the last call to clearRxOverflows()
+    FORCE_INLINE unsigned int rxOverflows(void)
     {
-      while (!((UCSR0A) & (1 << UDRE0)))
-        ;
+      unsigned char sreg = SREG;
+      cli();
+      unsigned int n = rx_buffer.overflows;
+      SREG = sreg;
+      return n;
+    }
 
-      UDR0 = c;
+    FORCE_INLINE void clearRxOverflows(void)
+    {
+      unsigned char sreg = SREG;
+      cli();
+      rx_buffer.overflows = 0;
+      SREG = sreg;
     }
     
-    
-    FORCE_INLINE void checkRx(void)
+    // Characters that can be written without waiting
+    FORCE_INLINE unsigned char availableForWrite(void)
     {
-      if((UCSR0A & (1<<RXC0)) != 0) {
-        unsigned char c  =  UDR0;
-        int i = (unsigned int)(rx_buffer.head + 1) % RX_BUFFER_SIZE;
-
-        // if we should be storing the received character into the location
-        // just before the tail (meaning that the head would advance to the
-        // current location of the tail), we're about to overflow the buffer
-        // and so we don't write the character or advance the head.
-        if (i != rx_buffer.tail) {
-          rx_buffer.buffer[rx_buffer.head] = c;
-          rx_buffer.head = i;
-        }
-      }
+      return (unsigned char)(TX_BUFFER_SIZE - 1 - ((tx_buffer.head - tx_buffer.tail) & (TX_BUFFER_SIZE - 1)));
     }
+
+    void write(uint8_t c);
+    void flushTx(void); // Waits until the TX ring is empty, call it before a cli() that stays
     
     
     private:
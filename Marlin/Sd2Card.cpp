@@ -21,6 +21,7 @@
 
 #ifdef SDSUPPORT
 #include "Sd2Card.h"
+#include "spibus.h"
 //------------------------------------------------------------------------------
 #ifndef SOFTWARE_SPI
 // functions for hardware SPI
@@ -152,6 +153,9 @@ static void spiSend(uint8_t data) {
 //------------------------------------------------------------------------------
 // send command and return error code.  Return zero for OK
 uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
+  // any other command ends a streaming read
+  if (inStream_ && cmd != CMD12) readStop();
+
   // select card
   chipSelectLow();
 
@@ -206,12 +210,14 @@ uint32_t Sd2Card::cardSize() {
 //------------------------------------------------------------------------------
 void Sd2Card::chipSelectHigh() {
   digitalWrite(chipSelectPin_, HIGH);
+  spi_sd_deselect();
 }
 //------------------------------------------------------------------------------
 void Sd2Card::chipSelectLow() {
 #ifndef SOFTWARE_SPI
   spiInit(spiRate_);
 #endif  // SOFTWARE_SPI
+  spi_sd_select();
   digitalWrite(chipSelectPin_, LOW);
 }
 //------------------------------------------------------------------------------
@@ -285,6 +291,7 @@ bool Sd2Card::eraseSingleBlockEnable() {
  */
 bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
   errorCode_ = type_ = 0;
+  inStream_ = false;
   chipSelectPin_ = chipSelectPin;
   // 16-bit init start time allows over a minute
   uint16_t t0 = (uint16_t)millis();
@@ -310,7 +317,9 @@ bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
 #endif  // SOFTWARE_SPI
 
   // must supply min of 74 clock cycles with CS high.
+  spi_sd_select();
   for (uint8_t i = 0; i < 10; i++) spiSend(0XFF);
+  spi_sd_deselect();
 
   // command to go idle in SPI mode
   while ((status_ = cardCommand(CMD0, 0)) != R1_IDLE_STATE) {
@@ -464,12 +473,40 @@ bool Sd2Card::readStart(uint32_t blockNumber) {
   return false;
 }
 //------------------------------------------------------------------------------
+/**
+ * Read a block as part of a streaming read.
+ *
+ * Consecutive block numbers are read from one READ_MULTIPLE_BLOCK (CMD18),
+ * so the card reads ahead and the command overhead of CMD17 is paid once.
+ * Any other block number, and any other command sent to the card, ends the
+ * stream with CMD12 first. readStreamStop() ends it explicitly.
+ *
+ * \param[in] blockNumber Logical block to be read.
+ * \param[out] dst Pointer to the location that will receive the data.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+bool Sd2Card::readStream(uint32_t blockNumber, uint8_t* dst) {
+  if (!inStream_ || blockNumber != streamBlock_) {
+    if (!readStart(blockNumber)) return false;
+    inStream_ = true;
+  }
+  if (!readData(dst)) {
+    readStop();
+    return false;
+  }
+  streamBlock_ = blockNumber + 1;
+  return true;
+}
+//------------------------------------------------------------------------------
 /** End a read multiple blocks sequence.
  *
 * \return The value one, true, is returned for success and
  * the value zero, false, is returned for failure.
  */
 bool Sd2Card::readStop() {
+  inStream_ = false;
   chipSelectLow();
   if (cardCommand(CMD12, 0)) {
     error(SD_CARD_ERROR_CMD12);
@@ -509,6 +546,11 @@ bool Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
   uint16_t t0 = millis();
   while (spiRec() != 0XFF) {
     if (((uint16_t)millis() - t0) >= timeoutMillis) goto fail;
+    // the card may be deselected while busy, let a held back galvo write out
+    if (spi_dac_waiting()) {
+      chipSelectHigh();
+      chipSelectLow();
+    }
   }
   return true;
 
@@ -154,7 +154,8 @@ uint8_t const SPI_SCK_PIN = SOFT_SPI_SCK_PIN;
 class Sd2Card {
  public:
   /** Construct an instance of Sd2Card. */
-  Sd2Card() : errorCode_(SD_CARD_ERROR_INIT_NOT_CALLED), type_(0) {}
+  Sd2Card() : errorCode_(SD_CARD_ERROR_INIT_NOT_CALLED), type_(0),
+    inStream_(false) {}
   uint32_t cardSize();
   bool erase(uint32_t firstBlock, uint32_t lastBlock);
   bool eraseSingleBlockEnable();
@@ -204,6 +205,11 @@ class Sd2Card {
   bool readData(uint8_t *dst);
   bool readStart(uint32_t blockNumber);
   bool readStop();
+  bool readStream(uint32_t blockNumber, uint8_t* dst);
+  /** End a streaming read started by readStream(), if one is open.
+   * \return true for success or false for failure.
+   */
+  bool readStreamStop() {return inStream_ ? readStop() : true;}
   bool setSckRate(uint8_t sckRateID);
   /** Return the card type: SD V1, SD V2 or SDHC
    * \return 0 - SD V1, 1 - SD V2, or 3 - SDHC.
@@ -220,6 +226,8 @@ class Sd2Card {
   uint8_t spiRate_;
   uint8_t status_;
   uint8_t type_;
+  bool inStream_;         // CMD18 open, see readStream()
+  uint32_t streamBlock_;  // block the open CMD18 delivers next
   // private functions
   uint8_t cardAcmd(uint8_t cmd, uint32_t arg) {
     cardCommand(CMD55, 0);
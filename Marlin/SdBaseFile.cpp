@@ -83,6 +83,42 @@ dir_t* SdBaseFile::cacheDirEntry(uint8_t action) {
   return 0;
 }
 //------------------------------------------------------------------------------
+/** Map the cluster chain of a file opened read only into \a cache.
+ *
+ * Reads and seeks then find their cluster in the runs instead of following
+ * the chain through the FAT. The FAT is still used if the file has more
+ * runs of contiguous clusters than fit into the cache.
+ *
+ * \param[in] cache Runs of this file until it is closed.
+ *
+ * \return The value one, true, is returned if the runs are cached and
+ * the value zero, false, is returned if the FAT has to be used.
+ */
+bool SdBaseFile::cacheExtents(SdExtentCache* cache) {
+  uint32_t cluster = firstCluster_;
+  uint32_t prev = 0;
+  uint32_t clusters;
+
+  extents_ = 0;
+  if (!isFile() || (flags_ & O_WRITE)) return false;
+  cache->count = 0;
+  clusters = fileSize_ ? ((fileSize_ - 1) >> (vol_->clusterSizeShift_ + 9)) + 1 : 0;
+  for (uint32_t index = 0; index < clusters; index++) {
+    if (index > 0 && !vol_->fatGet(prev, &cluster)) return false;
+    if (index > 0 && cluster == prev + 1) {
+      cache->run[cache->count - 1].end++;
+    } else {
+      if (cache->count == SD_EXTENT_COUNT) return false;
+      cache->run[cache->count].cluster = cluster;
+      cache->run[cache->count].end = index + 1;
+      cache->count++;
+    }
+    prev = cluster;
+  }
+  extents_ = cache;
+  return true;
+}
+//------------------------------------------------------------------------------
 /** Close a file and force cached data and directory information
  *  to be written to the storage device.
  *
@@ -91,6 +127,8 @@ dir_t* SdBaseFile::cacheDirEntry(uint8_t action) {
  * Reasons for failure include no file is open or an I/O error.
  */
 bool SdBaseFile::close() {
+  stopStream();
+  extents_ = 0;
   bool rtn = sync();
   type_ = FAT_FILE_TYPE_CLOSED;
   return rtn;
@@ -471,6 +509,7 @@ bool SdBaseFile::mkdir(SdBaseFile* parent, const uint8_t dname[11]) {
 
   // convert file to directory
   flags_ = O_READ;
+  extents_ = 0;
   type_ = FAT_FILE_TYPE_SUBDIR;
 
   // allocate and zero first cluster
@@ -765,6 +804,7 @@ bool SdBaseFile::openCachedEntry(uint8_t dirIndex, uint8_t oflag) {
   }
   // save open flags for read/write
   flags_ = oflag & F_OFLAG;
+  extents_ = 0;
 
   // set to start of file
   curCluster_ = 0;
@@ -1018,6 +1058,18 @@ bool SdBaseFile::printName() {
   return true;
 }
 //------------------------------------------------------------------------------
+// cluster with the given index in the file, from the cached runs
+uint32_t SdBaseFile::extentCluster(uint32_t index) {
+  uint32_t start = 0;
+  for (uint8_t i = 0; i < extents_->count; i++) {
+    if (index < extents_->run[i].end) {
+      return extents_->run[i].cluster + index - start;
+    }
+    start = extents_->run[i].end;
+  }
+  return 0;
+}
+//------------------------------------------------------------------------------
 /** Read the next byte from a file.
  *
  * \return For success read returns the next byte in the file as an int.
@@ -1067,6 +1119,8 @@ int16_t SdBaseFile::read(void* buf, uint16_t nbyte) {
         if (curPosition_ == 0) {
           // use first cluster in file
           curCluster_ = firstCluster_;
+        } else if (extents_) {
+          curCluster_ = extentCluster(curPosition_ >> (vol_->clusterSizeShift_ + 9));
         } else {
           // get next cluster from FAT
           if (!vol_->fatGet(curCluster_, &curCluster_)) goto fail;
@@ -1081,7 +1135,12 @@ int16_t SdBaseFile::read(void* buf, uint16_t nbyte) {
 
     // no buffering needed if n == 512
     if (n == 512 && block != vol_->cacheBlockNumber()) {
-      if (!vol_->readBlock(block, dst)) goto fail;
+      // the stream restarts after a non-contiguous cluster or a FAT read
+      if (flags_ & F_STREAM) {
+        if (!vol_->readStream(block, dst)) goto fail;
+      } else {
+        if (!vol_->readBlock(block, dst)) goto fail;
+      }
     } else {
       // read block to cache and copy data to caller
       if (!vol_->cacheRawBlock(block, SdVolume::CACHE_FOR_READ)) goto fail;
@@ -1419,8 +1478,8 @@ bool SdBaseFile::rmRfStar() {
       if (!f.remove()) goto fail;
     }
     // position to next entry if required
-    if (curPosition_ != (32*(index + 1))) {
-      if (!seekSet(32*(index + 1))) goto fail;
+    if (curPosition_ != (32UL*(index + 1))) {
+      if (!seekSet(32UL*(index + 1))) goto fail;
     }
   }
   // don't try to delete root
@@ -1442,6 +1501,7 @@ bool SdBaseFile::rmRfStar() {
  */
 SdBaseFile::SdBaseFile(const char* path, uint8_t oflag) {
   type_ = FAT_FILE_TYPE_CLOSED;
+  extents_ = 0;
   writeError = false;
   open(path, oflag);
 }
@@ -1458,6 +1518,7 @@ bool SdBaseFile::seekSet(uint32_t pos) {
   uint32_t nNew;
   // error if file not open or seek past end of file
   if (!isOpen() || pos > fileSize_) goto fail;
+  stopStream();
 
   if (type_ == FAT_FILE_TYPE_ROOT_FIXED) {
     curPosition_ = pos;
@@ -1473,6 +1534,12 @@ bool SdBaseFile::seekSet(uint32_t pos) {
   nCur = (curPosition_ - 1) >> (vol_->clusterSizeShift_ + 9);
   nNew = (pos - 1) >> (vol_->clusterSizeShift_ + 9);
 
+  if (extents_) {
+    curCluster_ = extentCluster(nNew);
+    curPosition_ = pos;
+    goto done;
+  }
+
   if (nNew < nCur || curPosition_ == 0) {
     // must follow chain from first cluster
     curCluster_ = firstCluster_;
@@ -175,6 +175,18 @@ uint16_t const FAT_DEFAULT_DATE = ((2000 - 1980) << 9) | (1 << 5) | 1;
 /** Default time for file timestamp is 1 am */
 uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 //------------------------------------------------------------------------------
+/**
+ * \struct SdExtentCache
+ * \brief Runs of contiguous clusters of a file, see SdBaseFile::cacheExtents().
+ */
+struct SdExtentCache {
+  uint8_t count;          // runs in use
+  struct {
+    uint32_t cluster;     // first cluster of the run
+    uint32_t end;         // index in the file of the cluster after the run
+  } run[SD_EXTENT_COUNT];
+};
+//------------------------------------------------------------------------------
 /**
  * \class SdBaseFile
  * \brief Base class for SdFile with Print and C++ streams.
@@ -182,7 +194,7 @@ uint16_t const FAT_DEFAULT_TIME = (1 << 11);
 class SdBaseFile {
  public:
   /** Create an instance. */
-  SdBaseFile() : writeError(false), type_(FAT_FILE_TYPE_CLOSED) {}
+  SdBaseFile() : writeError(false), type_(FAT_FILE_TYPE_CLOSED), extents_(0) {}
   SdBaseFile(const char* path, uint8_t oflag);
   ~SdBaseFile() {if(isOpen()) close();}
   /**
@@ -202,6 +214,7 @@ class SdBaseFile {
    */
   void setpos(fpos_t1* pos);
   //----------------------------------------------------------------------------
+  bool cacheExtents(SdExtentCache* cache);
   bool close();
   bool contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
   bool createContiguous(SdBaseFile* dirFile,
@@ -306,6 +319,15 @@ class SdBaseFile {
    */
   bool seekEnd(int32_t offset = 0) {return seekSet(fileSize_ + offset);}
   bool seekSet(uint32_t pos);
+  /** Read whole blocks with one multiple block read (see
+   * Sd2Card::readStream()) for a file that is read from start to end.
+   * \param[in] on true to stream, false for one command per block.
+   */
+  void setStreaming(bool on) {
+    stopStream();
+    if (on) flags_ |= F_STREAM;
+    else flags_ &= ~F_STREAM;
+  }
   bool sync();
   bool timestamp(SdBaseFile* file);
   bool timestamp(uint8_t flag, uint16_t year, uint8_t month, uint8_t day,
@@ -333,6 +355,8 @@ class SdBaseFile {
   static uint8_t const F_OFLAG = (O_ACCMODE | O_APPEND | O_SYNC);
   // sync of directory entry required
   static uint8_t const F_FILE_DIR_DIRTY = 0X80;
+  // whole blocks are read with Sd2Card::readStream()
+  static uint8_t const F_STREAM = 0X40;
 
   // private data
   uint8_t   flags_;         // See above for definition of flags_ bits
@@ -345,6 +369,7 @@ class SdBaseFile {
   uint32_t  fileSize_;      // file size in bytes
   uint32_t  firstCluster_;  // first cluster of file
   SdVolume* vol_;           // volume where file is located
+  SdExtentCache* extents_;  // cluster runs if cached, else the FAT is used
 
   /** experimental don't use */
   bool openParent(SdBaseFile* dir);
@@ -358,6 +383,8 @@ class SdBaseFile {
   bool open(SdBaseFile* dirFile, const uint8_t dname[11], uint8_t oflag);
   bool openCachedEntry(uint8_t cacheIndex, uint8_t oflags);
   dir_t* readDirCache();
+  uint32_t extentCluster(uint32_t index);
+  void stopStream() {if (flags_ & F_STREAM) vol_->readStreamStop();}
 //------------------------------------------------------------------------------
 // to be deleted
   static void printDirName( const dir_t& dir,
@@ -188,6 +188,9 @@ class SdVolume {
   }
   bool readBlock(uint32_t block, uint8_t* dst) {
     return sdCard_->readBlock(block, dst);}
+  bool readStream(uint32_t block, uint8_t* dst) {
+    return sdCard_->readStream(block, dst);}
+  bool readStreamStop() {return sdCard_->readStreamStop();}
   bool writeBlock(uint32_t block, const uint8_t* dst) {
     return sdCard_->writeBlock(block, dst);
   }
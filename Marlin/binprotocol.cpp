@@ -0,0 +1,295 @@
+#include "Marlin.h"
+#include "binprotocol.h"
+#include "language.h"
+#include "planner.h"
+#include "cardreader.h"
+
+#ifdef BINARY_PROTOCOL
+
+bool bin_mode = false;
+
+static uint8_t frame[BIN_HEADER_SIZE + BIN_MAX_PAYLOAD + BIN_CRC_SIZE];
+static uint8_t frame_count;          // Bytes of the current frame received so far
+static uint8_t expected_seq;
+static bool resend_requested;        // Waiting for expected_seq after a bad frame
+static long bin_pos[2];              // XY target of the last record in micrometres, base for BIN_REC_DELTA
+static float bin_feedrates[BIN_FEEDRATES]; // mm/min, 0 keeps the current feedrate
+static unsigned long bin_layer;      // Of the last BIN_REC_LAYER
+
+static long read_long(const uint8_t *p)
+{
+  return (long)((unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24));
+}
+
+static int read_int(const uint8_t *p)
+{
+  return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static float read_float(const uint8_t *p)
+{
+  float f;
+  memcpy(&f, p, sizeof(f));
+  return f;
+}
+
+void bin_begin()
+{
+  bin_mode = true;
+  frame_count = 0;
+  expected_seq = 0;
+  resend_requested = false;
+  bin_pos[X_AXIS] = lround(current_position[X_AXIS] * 1000.0);
+  bin_pos[Y_AXIS] = lround(current_position[Y_AXIS] * 1000.0);
+}
+
+static void bin_request_resend()
+{
+  if(resend_requested)
+    return;
+  resend_requested = true;
+  SERIAL_PROTOCOLPGM(MSG_RESEND);
+  SERIAL_PROTOCOLLN((int)expected_seq);
+}
+
+// XY come from bin_pos, Z stays where it is unless given. laser is -1 for a record without power.
+static void bin_move(float rz, float lz, uint8_t feed_index, int laser)
+{
+  float target[NUM_AXIS];
+  target[X_AXIS] = bin_pos[X_AXIS] * 0.001;
+  target[Y_AXIS] = bin_pos[Y_AXIS] * 0.001;
+  target[RZ_AXIS] = rz;
+  target[LZ_AXIS] = lz;
+  prepare_binary_move(target, (feed_index < BIN_FEEDRATES) ? bin_feedrates[feed_index] : 0, laser);
+}
+
+// Size of a record including its type byte, 0 for an unknown type
+static uint8_t bin_record_size(uint8_t type)
+{
+  switch(type) {
+    case BIN_REC_MOVE:     return BIN_REC_MOVE_SIZE;
+    case BIN_REC_DELTA:    return BIN_REC_DELTA_SIZE;
+    case BIN_REC_MOVE_Z:   return BIN_REC_MOVE_Z_SIZE;
+    case BIN_REC_LAYER:    return BIN_REC_LAYER_SIZE;
+    case BIN_REC_FEEDRATE: return BIN_REC_FEEDRATE_SIZE;
+    case BIN_REC_END:      return BIN_REC_END_SIZE;
+  }
+  return 0;
+}
+
+static void bin_run_record(const uint8_t *p)
+{
+  switch(p[0]) {
+    case BIN_REC_MOVE:
+      bin_pos[X_AXIS] = read_long(p + 1);
+      bin_pos[Y_AXIS] = read_long(p + 5);
+      bin_move(current_position[RZ_AXIS], current_position[LZ_AXIS], p[10], p[9]);
+      break;
+    case BIN_REC_DELTA:
+      bin_pos[X_AXIS] += read_int(p + 1);
+      bin_pos[Y_AXIS] += read_int(p + 3);
+      bin_move(current_position[RZ_AXIS], current_position[LZ_AXIS], p[6], p[5]);
+      break;
+    case BIN_REC_MOVE_Z:
+      bin_move(read_long(p + 1) * 0.001, read_long(p + 5) * 0.001, p[9], -1);
+      break;
+    case BIN_REC_LAYER:
+      bin_layer = read_long(p + 1);
+      break;
+    case BIN_REC_FEEDRATE:
+      if(p[1] < BIN_FEEDRATES)
+        bin_feedrates[p[1]] = read_float(p + 2);
+      break;
+    case BIN_REC_END:
+      bin_mode = false;
+      break;
+  }
+}
+
+// Runs the records of a frame that passed the checks. Returns false on a malformed record,
+// everything in front of it has been queued already.
+static bool bin_run_records(const uint8_t *p, uint8_t len)
+{
+  const uint8_t *end = p + len;
+  while(p < end) {
+    uint8_t size = bin_record_size(p[0]);
+    if(size == 0 || p + size > end)
+      return false;
+    bin_run_record(p);
+    p += size;
+  }
+  return true;
+}
+
+static void bin_frame_done()
+{
+  uint8_t len = frame[2];
+  uint16_t crc = frame[BIN_HEADER_SIZE + len] | (frame[BIN_HEADER_SIZE + len + 1] << 8);
+  if(bin_crc16(frame + 1, len + 2) != crc) {
+    bin_request_resend();
+    return;
+  }
+  uint8_t seq = frame[1];
+  if(seq != expected_seq) {
+    if((uint8_t)(seq + 1) == expected_seq) { // Our ok got lost, the frame is queued already
+      SERIAL_PROTOCOLPGM(MSG_OK);
+      SERIAL_PROTOCOLPGM(" ");
+      SERIAL_PROTOCOLLN((int)seq);
+    }
+    else
+      bin_request_resend();
+    return;
+  }
+  resend_requested = false;
+  expected_seq++;
+
+  if(IsStopped()) {
+    SERIAL_ERRORLNPGM(MSG_ERR_STOPPED);
+  }
+  else if(!bin_run_records(frame + BIN_HEADER_SIZE, len)) {
+    // Sent again it would queue the records in front of the bad one twice, so no resend
+    SERIAL_ERROR_START;
+    SERIAL_ERRORPGM("Bad binary record in frame ");
+    SERIAL_ERRORLN((int)seq);
+    return;
+  }
+  SERIAL_PROTOCOLPGM(MSG_OK);
+  SERIAL_PROTOCOLPGM(" ");
+  SERIAL_PROTOCOLLN((int)seq);
+}
+
+void bin_get_frame()
+{
+  while(MYSERIAL.available() > 0) {
+    uint8_t c = MYSERIAL.read();
+    if(frame_count == 0 && c != BIN_SYNC)
+      continue; // Hunt for the start of a frame
+    frame[frame_count++] = c;
+    if(frame_count < BIN_HEADER_SIZE)
+      continue;
+    if(frame[2] > BIN_MAX_PAYLOAD) {
+      frame_count = 0;
+      bin_request_resend();
+      continue;
+    }
+    if(frame_count == BIN_HEADER_SIZE + frame[2] + BIN_CRC_SIZE) {
+      frame_count = 0;
+      bin_frame_done();
+      return; // One frame per loop(), so manage_inactivity() keeps running
+    }
+  }
+}
+
+#ifdef SD_BINARY_JOB
+static unsigned long job_layers;     // Header of the selected SD job
+static unsigned long job_table;
+static float job_feedrates[2];
+
+// Next n bytes of the printed file, false at its end
+static bool job_read(uint8_t *p, uint8_t n)
+{
+  while(n--) {
+    int16_t c = card.get();
+    if(c < 0)
+      return false;
+    *p++ = c;
+  }
+  return true;
+}
+
+bool bin_job_select()
+{
+  uint8_t header[BIN_JOB_HEADER_SIZE];
+  if(!job_read(header, BIN_JOB_HEADER_SIZE) || memcmp(header, BIN_JOB_MAGIC, 4) != 0 ||
+     header[4] != BIN_JOB_VERSION || header[5] < BIN_JOB_HEADER_SIZE) {
+    card.setIndex(0); // G-code
+    return false;
+  }
+  job_layers = read_long(header + 8);
+  job_table = read_long(header + 12);
+  job_feedrates[0] = read_float(header + 20);
+  job_feedrates[1] = read_float(header + 24);
+  bin_layer = 0;
+  card.setIndex(header[5]);
+  SERIAL_ECHO_START;
+  SERIAL_ECHOPGM("Binary job, layers:");
+  SERIAL_ECHO(job_layers);
+  SERIAL_ECHOPGM(" thickness um:");
+  SERIAL_ECHOLN(read_long(header + 16));
+  return true;
+}
+
+// Also when a paused print goes on, bin_pos is where the last queued move went
+void bin_job_start()
+{
+  bin_pos[X_AXIS] = lround(current_position[X_AXIS] * 1000.0);
+  bin_pos[Y_AXIS] = lround(current_position[Y_AXIS] * 1000.0);
+  bin_feedrates[0] = job_feedrates[0];
+  bin_feedrates[1] = job_feedrates[1];
+}
+
+static void bin_job_error(unsigned long pos)
+{
+  SERIAL_ERROR_START;
+  SERIAL_ERRORPGM("Bad binary record at byte ");
+  SERIAL_ERRORLN(pos);
+  card.pauseSDPrint();
+}
+
+// Queues records until the planner is full. Called from loop() only when no G-code is
+// waiting, so commands from the host (M25, M105, ..) get through between the moves. Like
+// get_command() it leaves an empty read buffer to card.prefetch() while moves are queued.
+void bin_job_run()
+{
+  uint8_t record[BIN_REC_MAX_SIZE];
+  while(movesplanned() < BLOCK_BUFFER_SIZE - 1 && !IsStopped()) {
+    if(card.readBufferEmpty() && movesplanned() > 0)
+      return;
+    int16_t c = card.get();
+    if(c < 0) { // The end, also without BIN_REC_END
+      sd_print_finished();
+      return;
+    }
+    unsigned long pos = card.getIndex(); // Of the byte get() returned, the type of the record
+    record[0] = c;
+    uint8_t size = bin_record_size(record[0]);
+    if(size == 0 || !job_read(record + 1, size - 1)) {
+      bin_job_error(pos);
+      return;
+    }
+    if(record[0] == BIN_REC_END) {
+      sd_print_finished();
+      return;
+    }
+    bin_run_record(record);
+  }
+}
+
+void bin_job_seek_layer(long layer)
+{
+  if(layer < 0 || (unsigned long)layer >= job_layers) {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORPGM("No layer ");
+    SERIAL_ERRORLN(layer);
+    return;
+  }
+  uint8_t pos[4];
+  card.setIndex(job_table + 4 * layer);
+  if(!job_read(pos, 4)) {
+    bin_job_error(job_table + 4 * layer);
+    return;
+  }
+  card.setIndex(read_long(pos));
+  bin_layer = layer;
+}
+
+void bin_job_status()
+{
+  SERIAL_PROTOCOLPGM("Layer ");
+  SERIAL_PROTOCOL(bin_layer);
+  SERIAL_PROTOCOLPGM("/");
+  SERIAL_PROTOCOLLN(job_layers);
+}
+#endif //SD_BINARY_JOB
+
+#endif //BINARY_PROTOCOL
@@ -0,0 +1,96 @@
+#ifndef BINPROTOCOL_H
+#define BINPROTOCOL_H
+
+// Binary move frames, switched on with M610. This header is shared with the host tools in
+// ../tools, so it must not depend on anything from Arduino or Marlin.
+//
+// Frame:  SYNC | seq | len | payload[len] | crc16 low | crc16 high
+//   seq     counts 0,1,2,.. (mod 256) starting with the first frame after M610
+//   crc16   CRC-16/CCITT (poly 0x1021, init 0xFFFF) over seq, len and payload
+// Every good frame is answered with "ok <seq>", a bad or out of order one with "Resend:<seq>"
+// naming the frame expected next. Frames following a bad one are dropped until that arrives.
+// A frame whose CRC is right but holds a malformed record gets "Error:Bad binary record in
+// frame <seq>" instead of its ok. The records in front of the bad one have been queued, the
+// next frame expected is seq + 1. Like G0/G1 S the laser power of a record holds for that move
+// only after M604 S1, and a Z record without power runs dark then.
+//
+// The payload is a list of records, each starting with its type byte. All numbers are little
+// endian, positions are in micrometres.
+
+#include <stdint.h>
+
+#define BIN_SYNC            0xA5
+#define BIN_HEADER_SIZE     3     // sync, seq, len
+#define BIN_CRC_SIZE        2
+#define BIN_MAX_PAYLOAD     64
+#define BIN_FEEDRATES       16    // Entries in the feedrate table
+
+#define BIN_REC_MOVE        0x01  // int32 x, int32 y, uint8 laser power, uint8 feedrate index
+#define BIN_REC_DELTA       0x02  // int16 dx, int16 dy, uint8 laser power, uint8 feedrate index
+#define BIN_REC_MOVE_Z      0x03  // int32 rz, int32 lz, uint8 feedrate index
+#define BIN_REC_LAYER       0x04  // uint32 layer number, reported by M27 while an SD job runs
+#define BIN_REC_FEEDRATE    0x10  // uint8 index, float mm/min
+#define BIN_REC_END         0x7F  // Back to ASCII G-code after this frame
+
+#define BIN_REC_MOVE_SIZE     11  // Including the type byte
+#define BIN_REC_DELTA_SIZE    7
+#define BIN_REC_MOVE_Z_SIZE   10
+#define BIN_REC_LAYER_SIZE    5
+#define BIN_REC_FEEDRATE_SIZE 6
+#define BIN_REC_END_SIZE      1
+#define BIN_REC_MAX_SIZE      BIN_REC_MOVE_SIZE
+
+// SD jobs: the same records without frames in a file printed with M23/M24, see tools/binjob.cpp.
+// M23 recognizes them by the header:
+//    0  "SLBJ"
+//    4  uint8 version, uint8 header size (records start there), 2 bytes reserved
+//    8  uint32 layer count
+//   12  uint32 file position of the layer table, one uint32 file position per layer
+//   16  uint32 layer thickness in micrometres
+//   20  float jump feedrate, float mark feedrate (mm/min), preset as feedrate index 0 and 1
+//   28  4 bytes reserved
+// Every layer starts with BIN_REC_LAYER, its first XY move is a BIN_REC_MOVE and it defines
+// the feedrates it uses beyond index 0 and 1, so a print can start at any layer (M26 L<layer>).
+// The job ends with BIN_REC_END.
+#define BIN_JOB_MAGIC         "SLBJ"
+#define BIN_JOB_VERSION       1
+#define BIN_JOB_HEADER_SIZE   32
+
+#if defined(__AVR__)
+  #include <util/crc16.h>
+  #define bin_crc16_update(crc, data) _crc_xmodem_update(crc, data)
+#else
+  static inline uint16_t bin_crc16_update(uint16_t crc, uint8_t data)
+  {
+    crc ^= (uint16_t)data << 8;
+    for(uint8_t i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    return crc;
+  }
+#endif
+
+static inline uint16_t bin_crc16(const uint8_t *data, uint8_t count)
+{
+  uint16_t crc = 0xFFFF;
+  while(count--)
+    crc = bin_crc16_update(crc, *data++);
+  return crc;
+}
+
+#ifdef BINARY_PROTOCOL
+// Firmware side, see binprotocol.cpp
+extern bool bin_mode;  // Serial input is read as frames instead of G-code lines
+
+void bin_begin();      // M610
+void bin_get_frame();  // Called from loop() instead of get_command() while bin_mode is set
+
+#ifdef SD_BINARY_JOB
+bool bin_job_select();               // M23, true if the opened file is an SD job
+void bin_job_start();                // M24
+void bin_job_run();                  // Called from loop() while an SD job is printed
+void bin_job_seek_layer(long layer); // M26 L<layer>
+void bin_job_status();               // M27
+#endif
+#endif
+
+#endif
@@ -2,6 +2,7 @@
 #include "cardreader.h"
 #include "stepper.h"
 #include "language.h"
+#include "binprotocol.h"
 
 #ifdef SDSUPPORT
 
@@ -11,7 +12,12 @@ CardReader::CardReader()
 {
    filesize = 0;
    sdpos = 0;
+   readPos = 0;
+   readIndex = readLength = 0;
+   dirIndexValid = false;
+   uploadContiguous = false;
    sdprinting = false;
+   binaryJob = false;
    cardOK = false;
    saving = false;
    autostart_atmillis=0;
@@ -44,14 +50,24 @@ char *createFilename(char *buffer,const dir_t &p) //buffer>12characters
 }
 
 
+// Entries shown by getfilename(): subdirectories and *.G* files
+static bool isListed(const dir_t &p)
+{
+  if (p.name[0] == DIR_NAME_DELETED || p.name[0] == '.'|| p.name[0] == '_') return false;
+  if (!DIR_IS_FILE_OR_SUBDIR(&p)) return false;
+  if (!DIR_IS_SUBDIR(&p) && (p.name[8]!='G' || p.name[9]=='~')) return false;
+  return true;
+}
+
+// M20: prints the tree below parent. Each directory is read once, front to back, so the
+// directory index (buildDirIndex()) would not save a read here; it only serves the menu.
 void  CardReader::lsDive(const char *prepend,SdFile parent)
 {
   dir_t p;
- uint8_t cnt=0;
  
   while (parent.readDir(p, longFilename) > 0)
   {
-    if( DIR_IS_SUBDIR(&p) && lsAction!=LS_Count && lsAction!=LS_GetFilename) // hence LS_SerialPrint
+    if( DIR_IS_SUBDIR(&p))
     {
 
       char path[13*2];
@@ -72,12 +88,9 @@ void  CardReader::lsDive(const char *prepend,SdFile parent)
       SdFile dir;
       if(!dir.open(parent,lfilename, O_READ))
       {
-        if(lsAction==LS_SerialPrint)
-        {
-          SERIAL_ECHO_START;
-          SERIAL_ECHOLN(MSG_SD_CANT_OPEN_SUBDIR);
-          SERIAL_ECHOLN(lfilename);
-        }
+        SERIAL_ECHO_START;
+        SERIAL_ECHOLN(MSG_SD_CANT_OPEN_SUBDIR);
+        SERIAL_ECHOLN(lfilename);
       }
       lsDive(path,dir);
       //close done automatically by destructor of SdFile
@@ -103,34 +116,15 @@ void  CardReader::lsDive(const char *prepend,SdFile parent)
         if(p.name[8]!='G') continue;
         if(p.name[9]=='~') continue;
       }
-      //if(cnt++!=nr) continue;
       createFilename(filename,p);
-      if(lsAction==LS_SerialPrint)
-      {
-        SERIAL_PROTOCOL(prepend);
-        SERIAL_PROTOCOLLN(filename);
-      }
-      else if(lsAction==LS_Count)
-      {
-        nrFiles++;
-      } 
-      else if(lsAction==LS_GetFilename)
-      {
-        if(cnt==nrFiles)
-          return;
-        cnt++;
-        
-      }
+      SERIAL_PROTOCOL(prepend);
+      SERIAL_PROTOCOLLN(filename);
     }
   }
 }
 
 void CardReader::ls() 
 {
-  lsAction=LS_SerialPrint;
-  if(lsAction==LS_Count)
-  nrFiles=0;
-
   root.rewind();
   lsDive("",root);
 }
@@ -138,7 +132,10 @@ void CardReader::ls()
 
 void CardReader::initsd()
 {
+  if(saving)
+    closefile();
   cardOK = false;
+  dirIndexValid = false;
   if(root.isOpen())
     root.close();
   if (!card.init(SPI_FULL_SPEED,SDSS))
@@ -181,11 +178,14 @@ void CardReader::setroot()
     SERIAL_ECHOLNPGM(MSG_SD_WORKDIR_FAIL);
   }*/
   workDir=root;
+  dirIndexValid = false;
   
   curDir=&workDir;
 }
 void CardReader::release()
 {
+  if(saving)
+    closefile(); // Ends the multiple block write of M28, the card may be pulled next
   sdprinting = false;
   cardOK = false;
 }
@@ -213,8 +213,12 @@ void CardReader::openFile(char* name,bool read)
 {
   if(!cardOK)
     return;
-  file.close();
+  if(saving)
+    closefile();
+  else
+    file.close();
   sdprinting = false;
+  binaryJob = false;
   
   
   SdFile myDir;
@@ -225,12 +229,12 @@ void CardReader::openFile(char* name,bool read)
   if(name[0]=='/')
   {
     dirname_start=strchr(name,'/')+1;
-    while(dirname_start>0)
+    while(dirname_start!=NULL)
     {
       dirname_end=strchr(dirname_start,'/');
       //SERIAL_ECHO("start:");SERIAL_ECHOLN((int)(dirname_start-name));
       //SERIAL_ECHO("end  :");SERIAL_ECHOLN((int)(dirname_end-name));
-      if(dirname_end>0 && dirname_end>dirname_start)
+      if(dirname_end!=NULL && dirname_end>dirname_start)
       {
         char subdirname[13];
         strncpy(subdirname, dirname_start, dirname_end-dirname_start);
@@ -243,8 +247,9 @@ void CardReader::openFile(char* name,bool read)
           SERIAL_PROTOCOLLNPGM(".");
           return;
         }
-        else
-          ;//SERIAL_ECHOLN("dive ok");
+        else {
+          //SERIAL_ECHOLN("dive ok");
+        }
           
         curDir=&myDir; 
         dirname_start=dirname_end+1;
@@ -273,6 +278,13 @@ void CardReader::openFile(char* name,bool read)
       SERIAL_PROTOCOLPGM(MSG_SD_SIZE);
       SERIAL_PROTOCOLLN(filesize);
       sdpos = 0;
+      readPos = 0;
+      readIndex = readLength = 0;
+      file.cacheExtents(&extents); // Too fragmented: reads follow the FAT
+      file.setStreaming(true);
+      #ifdef SD_BINARY_JOB
+      binaryJob = bin_job_select();
+      #endif
       
       SERIAL_PROTOCOLLNPGM(MSG_SD_FILE_SELECTED);
     }
@@ -285,7 +297,8 @@ void CardReader::openFile(char* name,bool read)
   }
   else 
   { //write
-    if (!file.open(curDir, fname, O_CREAT | O_APPEND | O_WRITE | O_TRUNC))
+    if (!startUpload(curDir, fname) &&
+        !file.open(curDir, fname, O_CREAT | O_APPEND | O_WRITE | O_TRUNC))
     {
       SERIAL_PROTOCOLPGM(MSG_SD_OPEN_FILE_FAIL);
       SERIAL_PROTOCOL(fname);
@@ -294,6 +307,7 @@ void CardReader::openFile(char* name,bool read)
     else
     {
       saving = true;
+      dirIndexValid = false;
       SERIAL_PROTOCOLPGM(MSG_SD_WRITE_TO_FILE);
       SERIAL_PROTOCOLLN(name);
     }
@@ -305,8 +319,12 @@ void CardReader::removeFile(char* name)
 {
   if(!cardOK)
     return;
-  file.close();
+  if(saving)
+    closefile();
+  else
+    file.close();
   sdprinting = false;
+  binaryJob = false;
   
   
   SdFile myDir;
@@ -317,12 +335,12 @@ void CardReader::removeFile(char* name)
   if(name[0]=='/')
   {
     dirname_start=strchr(name,'/')+1;
-    while(dirname_start>0)
+    while(dirname_start!=NULL)
     {
       dirname_end=strchr(dirname_start,'/');
       //SERIAL_ECHO("start:");SERIAL_ECHOLN((int)(dirname_start-name));
       //SERIAL_ECHO("end  :");SERIAL_ECHOLN((int)(dirname_end-name));
-      if(dirname_end>0 && dirname_end>dirname_start)
+      if(dirname_end!=NULL && dirname_end>dirname_start)
       {
         char subdirname[13];
         strncpy(subdirname, dirname_start, dirname_end-dirname_start);
@@ -335,8 +353,9 @@ void CardReader::removeFile(char* name)
           SERIAL_PROTOCOLLNPGM(".");
           return;
         }
-        else
-          ;//SERIAL_ECHOLN("dive ok");
+        else {
+          //SERIAL_ECHOLN("dive ok");
+        }
           
         curDir=&myDir; 
         dirname_start=dirname_end+1;
@@ -357,6 +376,7 @@ void CardReader::removeFile(char* name)
   }
     if (file.remove(curDir, fname)) 
     {
+      dirIndexValid = false;
       SERIAL_PROTOCOLPGM("File deleted:");
       SERIAL_PROTOCOL(fname);
       sdpos = 0;
@@ -382,22 +402,52 @@ void CardReader::getStatus()
     SERIAL_PROTOCOLLNPGM(MSG_SD_NOT_PRINTING);
   }
 }
+// Reads on from readPos. Up to the next block boundary only, so later reads of whole blocks
+// bypass the volume cache.
+bool CardReader::fillReadBuffer()
+{
+  uint16_t n = SD_READ_BUFFER_SIZE;
+  if(n >= 512)
+    n -= readPos & 0x1FF;
+  int16_t got = file.read(readBuffer, n);
+  readIndex = 0;
+  readLength = (got > 0) ? got : 0;
+  return readLength > 0;
+}
+
+// Refills the read buffer while the firmware waits anyway (called from manage_inactivity()),
+// so get_command() seldom has to wait for the card.
+void CardReader::prefetch()
+{
+  if(sdprinting && readIndex >= readLength && readPos < filesize)
+    fillReadBuffer();
+}
+
 void CardReader::write_command(char *buf)
 {
-  char* begin = buf;
-  char* npos = 0;
-  char* end = buf + strlen(buf) - 1;
+  // Line number and checksum were stripped from buf when it was received
+  write_data((const uint8_t *)buf, strlen(buf));
+  write_data((const uint8_t *)"\r\n", 2);
+}
 
-  file.writeError = false;
-  if((npos = strchr(buf, 'N')) != NULL)
+void CardReader::write_data(const uint8_t *data, uint16_t n)
+{
+  if(uploadContiguous)
   {
-    begin = strchr(npos, ' ') + 1;
-    end = strchr(npos, '*') - 1;
+    while(n > 0)
+    {
+      uint16_t part = min(n, 512 - writeIndex);
+      memcpy(writeBuffer + writeIndex, data, part);
+      writeIndex += part;
+      data += part;
+      n -= part;
+      if(writeIndex == 512)
+        writeUploadBlock();
+    }
+    return;
   }
-  end[1] = '\r';
-  end[2] = '\n';
-  end[3] = '\0';
-  file.write(begin);
+  file.writeError = false;
+  file.write(data, n);
   if (file.writeError)
   {
     SERIAL_ERROR_START;
@@ -405,6 +455,69 @@ void CardReader::write_command(char *buf)
   }
 }
 
+// M28 writes into SD_UPLOAD_PREALLOCATE bytes of contiguous clusters, one multiple block write
+// that only ends at M29, instead of a read-modify-write of the cached block per line. The file
+// is cut to its real size at the end, by closefile(), which M21, M22, M23, M28, M30 and kill()
+// call too when a file is still being written. False if the card has no such free space.
+bool CardReader::startUpload(SdFile *dir, const char *name)
+{
+  uint32_t bgn, end;
+  uploadContiguous = false;
+  SdFile::remove(dir, name); // M28 replaces the file anyway, createContiguous() wants a new one
+  if(!file.createContiguous(dir, name, SD_UPLOAD_PREALLOCATE))
+    return false;
+  if(!file.contiguousRange(&bgn, &end) ||
+     !card.writeStart(bgn, SD_UPLOAD_PREALLOCATE / 512))
+  {
+    file.remove();
+    return false;
+  }
+  uploadBlock = bgn;
+  uploadEnd = bgn + SD_UPLOAD_PREALLOCATE / 512;
+  uploadSize = 0;
+  writeIndex = 0;
+  uploadContiguous = true;
+  return true;
+}
+
+void CardReader::writeUploadBlock()
+{
+  writeIndex = 0;
+  if(uploadBlock < uploadEnd)
+  {
+    if(!card.writeData(writeBuffer))
+    {
+      SERIAL_ERROR_START;
+      SERIAL_ERRORLNPGM(MSG_SD_ERR_WRITE_TO_FILE);
+    }
+    uploadBlock++;
+    uploadSize += 512;
+    return;
+  }
+  // Preallocated space used up, the rest is appended through SdBaseFile
+  card.writeStop();
+  uploadContiguous = false;
+  file.seekSet(uploadSize);
+  write_data(writeBuffer, 512);
+}
+
+void CardReader::finishUpload()
+{
+  if(writeIndex > 0)
+  {
+    memset(writeBuffer + writeIndex, 0, 512 - writeIndex);
+    uploadSize += writeIndex;
+    if(!card.writeData(writeBuffer))
+    {
+      SERIAL_ERROR_START;
+      SERIAL_ERRORLNPGM(MSG_SD_ERR_WRITE_TO_FILE);
+    }
+  }
+  card.writeStop();
+  uploadContiguous = false;
+  file.truncate(uploadSize); // Frees the clusters not written to
+}
+
 
 void CardReader::checkautostart(bool force)
 {
@@ -458,30 +571,60 @@ void CardReader::checkautostart(bool force)
 
 void CardReader::closefile()
 {
+  if(uploadContiguous)
+    finishUpload();
   file.sync();
   file.close();
   saving = false; 
 }
 
+// One pass over workDir, remembers where the listed entries start. readDir() from such a
+// position returns the entry together with its long name.
+void CardReader::buildDirIndex()
+{
+  dir_t p;
+  dirIndexCount=0;
+  workDir.rewind();
+  for(;;)
+  {
+    uint32_t pos=workDir.curPosition();
+    if(workDir.readDir(p, longFilename) <= 0) break;
+    if(!isListed(p)) continue;
+    if(dirIndexCount < SD_DIR_INDEX_SIZE)
+      dirIndex[dirIndexCount]=pos>>5;
+    dirIndexCount++;
+  }
+  dirIndexValid=true;
+}
+
 void CardReader::getfilename(const uint8_t nr)
 {
   curDir=&workDir;
-  lsAction=LS_GetFilename;
-  nrFiles=nr;
-  curDir->rewind();
-  lsDive("",*curDir);
-  
+  if(!dirIndexValid)
+    buildDirIndex();
+  if(nr >= dirIndexCount)
+    return;
+  // Beyond the index the directory is read on from its last entry
+  uint16_t i = (nr < SD_DIR_INDEX_SIZE) ? nr : SD_DIR_INDEX_SIZE-1;
+  uint16_t skip = nr-i;
+  dir_t p;
+  workDir.seekSet((uint32_t)dirIndex[i]<<5);
+  while(workDir.readDir(p, longFilename) > 0)
+  {
+    if(!isListed(p)) continue;
+    if(skip--) continue;
+    filenameIsDir=DIR_IS_SUBDIR(&p);
+    createFilename(filename,p);
+    return;
+  }
 }
 
 uint16_t CardReader::getnrfilenames()
 {
   curDir=&workDir;
-  lsAction=LS_Count;
-  nrFiles=0;
-  curDir->rewind();
-  lsDive("",*curDir);
-  //SERIAL_ECHOLN(nrFiles);
-  return nrFiles;
+  if(!dirIndexValid)
+    buildDirIndex();
+  return dirIndexCount;
 }
 
 void CardReader::chdir(const char * relpath)
@@ -504,6 +647,7 @@ void CardReader::chdir(const char * relpath)
     workDirParent=*parent;
     
     workDir=newfile;
+    dirIndexValid = false;
   }
 }
 
@@ -513,6 +657,7 @@ void CardReader::updir()
   {
     workDir=workDirParent;
     workDirParent=workDirParentParent;
+    dirIndexValid = false;
   }
 }
 
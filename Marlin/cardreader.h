@@ -4,7 +4,6 @@
 #ifdef SDSUPPORT
 
 #include "SdFile.h"
-enum LsAction {LS_SerialPrint,LS_Count,LS_GetFilename};
 class CardReader
 {
 public:
@@ -12,6 +11,7 @@ public:
   
   void initsd();
   void write_command(char *buf);
+  void write_data(const uint8_t *data, uint16_t n);
   //files auto[0-9].g on the sd card are performed in a row
   //this is to delay autostart and hence the initialisaiton of the sd card to some seconds after the normal init, so the device is available quick after a reset
 
@@ -36,14 +36,23 @@ public:
 
 
   FORCE_INLINE bool eof() { return sdpos>=filesize ;};
-  FORCE_INLINE int16_t get() {  sdpos = file.curPosition();return (int16_t)file.read();};
-  FORCE_INLINE void setIndex(long index) {sdpos = index;file.seekSet(index);};
+  // sdpos is the position of the character returned, filesize after the last one
+  FORCE_INLINE int16_t get() {
+    if(readIndex >= readLength && !fillReadBuffer()) { sdpos = filesize; return -1; }
+    sdpos = readPos++;
+    return readBuffer[readIndex++];
+  };
+  FORCE_INLINE bool readBufferEmpty() { return readIndex >= readLength; };
+  void prefetch();
+  FORCE_INLINE uint32_t getIndex() { return sdpos; };
+  FORCE_INLINE void setIndex(long index) {sdpos = index;file.seekSet(index);readPos = index;readIndex = readLength = 0;};
   FORCE_INLINE uint8_t percentDone(){if(!sdprinting) return 0; if(filesize) return sdpos*100/filesize; else return 0;};
   FORCE_INLINE char* getWorkDirName(){workDir.getFilename(filename);return filename;};
 
 public:
   bool saving;
   bool sdprinting ;  
+  bool binaryJob;   // The selected file is an SD job of binary records, see binprotocol.h
   bool cardOK ;
   char filename[13];
   char longFilename[LONG_FILENAME_LENGTH];
@@ -54,18 +63,40 @@ private:
   Sd2Card card;
   SdVolume volume;
   SdFile file;
+  SdExtentCache extents; // Cluster runs of file while it is open for reading
   uint32_t filesize;
   //int16_t n;
   unsigned long autostart_atmillis;
   uint32_t sdpos ;
 
+  union {
+    uint8_t readBuffer[SD_READ_BUFFER_SIZE]; // Part of the file being printed, handed out by get()
+    uint8_t writeBuffer[512];                // Block of an M28 upload to contiguous clusters
+  };
+  uint16_t readIndex, readLength;
+  uint32_t readPos;                        // File position of readBuffer[readIndex]
+  bool fillReadBuffer();
+
+  bool uploadContiguous;  // M28 file preallocated, written with multiple block writes
+  uint16_t writeIndex;    // Bytes in writeBuffer
+  uint32_t uploadBlock;   // Card block for writeBuffer
+  uint32_t uploadEnd;     // First block after the preallocated clusters
+  uint32_t uploadSize;    // Bytes written to the card
+  bool startUpload(SdFile *dir, const char *name);
+  void writeUploadBlock();
+  void finishUpload();
+
+  uint16_t dirIndex[SD_DIR_INDEX_SIZE];    // Entry (position / 32) in workDir of file nr
+  uint16_t dirIndexCount;                  // Listed files, also those beyond the index
+  bool dirIndexValid;                      // Cleared when workDir or its files change
+  void buildDirIndex();
+
   bool autostart_stilltocheck; //the sd start is delayed, because otherwise the serial cannot answer fast enought to make contact with the hostsoftware.
   
-  LsAction lsAction; //stored for recursion.
-  int16_t nrFiles; //counter for the files in the current directory and recycled as position counter for getting the nrFiles'th name in the directory.
   char* diveDirName;
   void lsDive(const char *prepend,SdFile parent);
 };
+extern CardReader card;
 #define IS_SD_PRINTING (card.sdprinting)
 
 #else
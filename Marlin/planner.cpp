@@ -370,13 +370,21 @@ void plan_init() {
   previous_nominal_speed = 0.0;
 }
 
+#if LASER_PIN > -1
+static bool laser_idle_changed = false;
+
+void plan_set_idle_laser_power()
+{
+  laser_idle_changed = true;
+}
+#endif
+
 void check_axes_activity() {
   unsigned char x_active = 0;
   unsigned char y_active = 0;  
   unsigned char z_active = 0;
   unsigned char e_active = 0;
   unsigned char fan_speed = 0;
-  unsigned char laser_power = 0;
   unsigned char tail_fan_speed = 0;
   block_t *block;
 
@@ -390,7 +398,6 @@ void check_axes_activity() {
       if(block->steps_rz != 0) z_active++;
       if(block->steps_lz != 0) e_active++;
       if(block->fan_speed != 0) fan_speed++;
-      if(block->laser_power != 0) laser_power++;
       block_index = (block_index+1) & (BLOCK_BUFFER_SIZE - 1);
     }
   }
@@ -402,8 +409,9 @@ void check_axes_activity() {
 #endif
 
 #if LASER_PIN > -1
-    if (LaserPower != 0){
-      analogWrite(LASER_PIN,LaserPower); // If buffer is empty use current Laser Power
+    if(laser_idle_changed) { // While moves run the stepper ISR sets the power of each block
+      laser_idle_changed = false;
+      st_set_laser_power(LaserPower);
     }
 #endif
   }
@@ -423,18 +431,58 @@ void check_axes_activity() {
   }
 #endif
 
-#if LASER_PIN > -1
-  if((LaserPower == 0) && (laser_power ==0)) 
-  {
-   analogWrite(LASER_PIN,0);
+}
+
+#ifdef Z_POWER_MANAGEMENT
+static unsigned long z_last_use;  // millis() when a Z block was last running or about to run
+static bool z_held = false;       // Z drivers were enabled by manage_z_power()
+static uint8_t z_scan_head = 0xFF, z_scan_tail; // The queue as z_block_due() last saw it
+static bool z_scan_busy, z_scan_due;
+
+// Whether a Z block starts within Z_ENABLE_LEAD_TIME, estimated from the queue alone
+static bool z_block_due(uint8_t block_index, uint8_t head) {
+  float lead_ms = 0; // Estimated time until the first queued Z block starts
+  while(block_index != head && lead_ms <= Z_ENABLE_LEAD_TIME) {
+    block_t *block = &block_buffer[block_index];
+    if(block->steps_rz != 0 || block->steps_lz != 0)
+      return true;
+    // The running block counts as done, so the estimate errs on the early side.
+    // Nominal speed ignores acceleration, which also makes it early.
+    if(!block->busy && block->nominal_speed > 0)
+      lead_ms += block->millimeters * 1000.0 / block->nominal_speed;
+    block_index = next_block_index(block_index);
   }
-  
-  if(LaserPower != 0)
-  {
-   analogWrite(LASER_PIN,LaserPower);
+  return false;
+}
+
+// Switch the Z drivers on Z_ENABLE_LEAD_TIME before the first queued Z block and off again
+// Z_RELEASE_DELAY after the last one, so they stay cold during galvo-only exposures.
+// The float estimate only changes when a block is planned, starts or is done, so it is
+// not redone on every call from manage_inactivity().
+void manage_z_power() {
+  uint8_t head = block_buffer_head, tail = block_buffer_tail;
+  bool busy = (tail != head) && block_buffer[tail].busy;
+  if(head != z_scan_head || tail != z_scan_tail || busy != z_scan_busy) {
+    // Read before the scan: if the ISR moves on meanwhile, the next call scans again
+    z_scan_head = head;
+    z_scan_tail = tail;
+    z_scan_busy = busy;
+    z_scan_due = z_block_due(tail, head);
+  }
+
+  if(z_scan_due) {
+    enable_rz();
+    enable_lz();
+    z_last_use = millis();
+    z_held = true;
+  }
+  else if(z_held && (millis() - z_last_use) > Z_RELEASE_DELAY) {
+    disable_rz();
+    disable_lz();
+    z_held = false;
   }
-#endif
 }
+#endif //Z_POWER_MANAGEMENT
 
 
 float junction_deviation = 0.1;
@@ -502,14 +550,16 @@ void plan_buffer_line(const float &x, const float &y, const float &z, const floa
   //enable active axes
   if(block->steps_x != 0) enable_x();
   if(block->steps_y != 0) enable_y();
-#ifndef Z_LATE_ENABLE
+#if !defined(Z_LATE_ENABLE) && !defined(Z_POWER_MANAGEMENT)
   if(block->steps_rz != 0) enable_rz();
 #endif
 
   // Enable all
+#ifndef Z_POWER_MANAGEMENT
   if(block->steps_lz != 0) { 
     enable_lz(); 
   }
+#endif
 
   if (block->steps_lz == 0) {
     if(feed_rate<mintravelfeedrate) feed_rate=mintravelfeedrate;
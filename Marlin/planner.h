@@ -60,7 +60,7 @@ typedef struct {
   unsigned long final_rate;                          // The minimal rate at exit
   unsigned long acceleration_st;                     // acceleration steps/sec^2
   unsigned long fan_speed;
-  unsigned long laser_power;
+  unsigned char laser_power;                         // Set on LASER_PIN by the stepper ISR when the block starts
   volatile char busy;
 } block_t;
 
@@ -78,6 +78,16 @@ void plan_set_e_position(const float &e);
 
 
 void check_axes_activity();
+
+#if LASER_PIN > -1
+// M600/M601: LaserPower goes on the laser as soon as the queue is empty. After the last move the
+// stepper ISR turns the laser off, it only comes back on through this.
+void plan_set_idle_laser_power();
+#endif
+
+#ifdef Z_POWER_MANAGEMENT
+void manage_z_power(); // Enable Z ahead of queued Z moves, release it after them
+#endif
 uint8_t movesplanned(); //return the nr of buffered moves
 
 extern unsigned long minsegmenttime;
@@ -0,0 +1,140 @@
+#include "Marlin.h"
+#include "spibus.h"
+#include "fastio.h"
+#include <SPI.h>
+
+#ifdef GALVO_SS_PIN
+
+// The DAC takes a channel byte and a value byte while GALVO_SS_PIN is low
+
+#ifdef GALVO_USART_SPI
+
+// USART1 in master SPI mode, mode 0, MSB first. XCK1 (PD5) is the clock, TXD1 (PD3) the data.
+void spi_bus_init()
+{
+  SET_OUTPUT(GALVO_SS_PIN);
+  WRITE(GALVO_SS_PIN, HIGH);
+  UBRR1 = 0;
+  DDRD |= _BV(5);
+  UCSR1C = _BV(UMSEL11) | _BV(UMSEL10);
+  UCSR1B = _BV(TXEN1);
+  UBRR1 = (1 << GALVO_SPI_RATE) - 1;  // F_CPU / 2^(1 + GALVO_SPI_RATE) like the SD rates
+}
+
+static void dac_byte(uint8_t b)
+{
+  while(!(UCSR1A & _BV(UDRE1)));
+  UDR1 = b;
+}
+
+void spi_dac_write(uint8_t channel, uint8_t value)
+{
+  uint8_t sreg = SREG;
+  cli();
+  WRITE(GALVO_SS_PIN, LOW);
+  UCSR1A = _BV(TXC1);
+  dac_byte(channel);
+  dac_byte(value);
+  while(!(UCSR1A & _BV(TXC1)));
+  WRITE(GALVO_SS_PIN, HIGH);
+  SREG = sreg;
+}
+
+#else // GALVO_USART_SPI
+
+volatile bool spi_sd_selected = false;
+volatile uint8_t spi_dac_pending = 0;
+static uint8_t dac_value[8];
+#ifdef STEPPER_ISR_PROFILE
+static unsigned long dac_held_since;  // micros() of the first write held back
+static unsigned long dac_max_held;
+#endif
+
+void spi_bus_init()
+{
+  SET_OUTPUT(GALVO_SS_PIN);
+  WRITE(GALVO_SS_PIN, HIGH);
+  SPI.begin();
+}
+
+static void dac_byte(uint8_t b)
+{
+  SPDR = b;
+  while(!(SPSR & _BV(SPIF)));
+}
+
+// Writes the pending channels with interrupts off. The SD card is not selected and has no
+// byte in flight here, only its clock setting has to be kept.
+static void dac_send()
+{
+  uint8_t spcr = SPCR;
+  uint8_t spsr = SPSR;
+  SPCR = _BV(SPE) | _BV(MSTR) | (GALVO_SPI_RATE >> 1);
+  SPSR = ((GALVO_SPI_RATE & 1) || GALVO_SPI_RATE == 6) ? 0 : _BV(SPI2X);
+  #ifdef STEPPER_ISR_PROFILE
+  if(dac_held_since != 0) {
+    unsigned long held = micros() - dac_held_since;
+    if(held > dac_max_held)
+      dac_max_held = held;
+    dac_held_since = 0;
+  }
+  #endif
+  for(uint8_t channel = 0; spi_dac_pending; channel++) {
+    if(!(spi_dac_pending & _BV(channel)))
+      continue;
+    spi_dac_pending &= ~_BV(channel);
+    WRITE(GALVO_SS_PIN, LOW);
+    dac_byte(channel);
+    dac_byte(dac_value[channel]);
+    WRITE(GALVO_SS_PIN, HIGH);
+  }
+  SPCR = spcr;
+  SPSR = spsr & _BV(SPI2X);
+}
+
+void spi_dac_write(uint8_t channel, uint8_t value)
+{
+  uint8_t sreg = SREG;
+  cli();
+  dac_value[channel] = value;
+  spi_dac_pending |= _BV(channel);
+  if(!spi_sd_selected)
+    dac_send();
+  #ifdef STEPPER_ISR_PROFILE
+  else if(dac_held_since == 0)
+    dac_held_since = micros() | 1; // 0 means nothing held
+  #endif
+  SREG = sreg;
+}
+
+void spi_dac_flush()
+{
+  uint8_t sreg = SREG;
+  cli();
+  if(!spi_sd_selected)
+    dac_send();
+  SREG = sreg;
+}
+
+#ifdef STEPPER_ISR_PROFILE
+unsigned long spi_dac_max_held()
+{
+  uint8_t sreg = SREG;
+  cli();
+  unsigned long held = dac_max_held;
+  SREG = sreg;
+  return held;
+}
+
+void spi_dac_profile_reset()
+{
+  uint8_t sreg = SREG;
+  cli();
+  dac_max_held = 0;
+  SREG = sreg;
+}
+#endif
+
+#endif // GALVO_USART_SPI
+
+#endif // GALVO_SS_PIN
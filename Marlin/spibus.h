@@ -0,0 +1,54 @@
+#ifndef SPIBUS_H
+#define SPIBUS_H
+
+// The galvo DAC and the SD card share the hardware SPI. The stepper interrupt writes the DAC
+// at any time, also in the middle of an SD transfer, so the two are arbitrated here:
+//  - Sd2Card marks the time its chip select is low with spi_sd_select()/spi_sd_deselect()
+//  - a DAC write while the card is selected only records the value, it goes out when the card
+//    is deselected next (between blocks, or while a write is programmed, see Sd2Card)
+//  - the DAC runs at its own clock (GALVO_SPI_RATE), the SD clock is restored afterwards
+// With GALVO_USART_SPI the DAC is on USART1 in SPI master mode instead and is always written
+// at once, so SD transfers and galvo moves do not wait for each other at all.
+//
+// Pausing a transfer for the DAC is not possible: the card needs its chip select low from the
+// command to the CRC of a data block, and the block loops of Sd2Card always have a byte in
+// flight. A write is held back for at most one block with its access time, about 0.6 ms for
+// the 514 bytes at 8 MHz plus the card's latency. With STEPPER_ISR_PROFILE, M603 reports the
+// longest hold measured.
+
+#include "Marlin.h"
+
+#ifdef GALVO_SS_PIN
+
+void spi_bus_init();
+void spi_dac_write(uint8_t channel, uint8_t value);
+
+#ifndef GALVO_USART_SPI
+extern volatile bool spi_sd_selected;
+extern volatile uint8_t spi_dac_pending;   // Channels written while the card was selected
+
+void spi_dac_flush();
+#ifdef STEPPER_ISR_PROFILE
+unsigned long spi_dac_max_held(); // Longest time in us a DAC write waited for the SD card
+void spi_dac_profile_reset();
+#endif
+
+FORCE_INLINE bool spi_dac_waiting() { return spi_dac_pending != 0; }
+FORCE_INLINE void spi_sd_select() { spi_sd_selected = true; }
+FORCE_INLINE void spi_sd_deselect()
+{
+  spi_sd_selected = false;
+  if(spi_dac_pending)
+    spi_dac_flush();
+}
+#endif
+
+#endif // GALVO_SS_PIN
+
+#if !defined(GALVO_SS_PIN) || defined(GALVO_USART_SPI)
+FORCE_INLINE void spi_sd_select() {}
+FORCE_INLINE void spi_sd_deselect() {}
+FORCE_INLINE bool spi_dac_waiting() { return false; }
+#endif
+
+#endif
@@ -27,7 +27,7 @@
 #include "language.h"
 #include "speed_lookuptable.h"
 
-#include <SPI.h>
+#include "spibus.h"
 
 //===========================================================================
 //=============================public variables  ============================
@@ -50,8 +50,8 @@ volatile static unsigned long step_events_completed; // The number of step event
 #ifdef ADVANCE
   static long advance_rate, advance, final_advance = 0;
   static long old_advance = 0;
+  static long lz_steps[3];
 #endif
-static long lz_steps[3];
 static long acceleration_time, deceleration_time;
 //static unsigned long accelerate_until, decelerate_after, acceleration_rate, initial_rate, final_rate, nominal_rate;
 static unsigned short acc_step_rate; // needed for deccelaration start point
@@ -66,24 +66,78 @@ static volatile bool endstop_x_hit=false;
 static volatile bool endstop_y_hit=false;
 static volatile bool endstop_z_hit=false;
 
-static bool old_x_min_endstop=false;
-static bool old_x_max_endstop=false;
-static bool old_y_min_endstop=false;
-static bool old_y_max_endstop=false;
-static bool old_z_min_endstop=false;
-static bool old_z_max_endstop=false;
+#if Z_MIN_PIN > -1
+  static bool old_z_min_endstop=false;
+#endif
+#if Z_MAX_PIN > -1
+  static bool old_z_max_endstop=false;
+#endif
 
 static bool check_endstops = true;
 
 volatile long count_position[NUM_AXIS] = { 0, 0, 0, 0};
 volatile char count_direction[NUM_AXIS] = { 1, 1, 1, 1};
 
+#ifdef STEPPER_ISR_PROFILE
+  // The counter and the "deadline missed" test can be predefined by a host build
+  // that emulates timer 1, so profiles from the board and the host read the same.
+  #ifndef ISR_PROFILE_TIMER
+    #define ISR_PROFILE_TIMER TCNT1
+  #endif
+  #ifndef ISR_PROFILE_WRAPPED
+    // A compare match while we were busy: in CTC mode the counter restarted from 0 at OCR1A
+    #define ISR_PROFILE_WRAPPED (TIFR1 & (1<<OCF1A))
+    #define ISR_PROFILE_TOP OCR1A
+  #endif
+  #ifndef ISR_PROFILE_MISSED
+    // The counter wrapped, or the new OCR1A is one it already passed (it then runs up to
+    // 0xFFFF before the next step).
+    #define ISR_PROFILE_MISSED(ticks) (ISR_PROFILE_WRAPPED || (ticks) >= OCR1A)
+  #endif
+
+  #define ISR_PHASE_POP    0
+  #define ISR_PHASE_ACCEL  1
+  #define ISR_PHASE_CRUISE 2
+  #define ISR_PHASE_DECEL  3
+  #define ISR_PHASES       4
+  #define ISR_PHASE_NONE   0xFF
+
+  // Histogram bucket 0 holds durations below 32 ticks (16us), each further bucket doubles
+  // the limit and the last one collects everything from 2048 ticks (1ms) on.
+  #define ISR_PROFILE_BUCKETS 8
+  #define ISR_PROFILE_BUCKET0_SHIFT 5
+
+  typedef struct {
+    unsigned short min_ticks, max_ticks;
+    unsigned long sum_ticks, count;
+    unsigned short hist[ISR_PROFILE_BUCKETS];
+  } isr_profile_t;
+
+  static isr_profile_t isr_profile[ISR_PHASES];
+  static unsigned long isr_profile_missed;
+  static unsigned short isr_profile_max_latency; // Ticks between compare match and ISR entry
+  static unsigned short isr_profile_entry;
+  static unsigned char isr_profile_phase;
+
+  static const char isr_phase_names[ISR_PHASES][7] PROGMEM = { "pop", "accel", "cruise", "decel" };
+
+  #define ISR_PROFILE_START() { isr_profile_entry = ISR_PROFILE_TIMER; isr_profile_phase = ISR_PHASE_NONE; }
+  // The first phase set in an interrupt wins, so a block pop is not counted as acceleration.
+  #define ISR_PROFILE_PHASE(p) { if(isr_profile_phase == ISR_PHASE_NONE) isr_profile_phase = (p); }
+  #define ISR_PROFILE_END() isr_profile_record(ISR_PROFILE_TIMER)
+#else
+  #define ISR_PROFILE_START()
+  #define ISR_PROFILE_PHASE(p)
+  #define ISR_PROFILE_END()
+#endif //STEPPER_ISR_PROFILE
+
 //===========================================================================
 //=============================functions         ============================
 //===========================================================================
 
   #define CHECK_ENDSTOPS  if(check_endstops)
 
+#ifdef __AVR__
 // intRes = intIn1 * intIn2 >> 16
 // uses:
 // r26 to store 0
@@ -153,6 +207,14 @@ asm volatile ( \
 : \
 "r26" , "r27" \
 )
+#else
+// Host builds (tools/steptest), rounded like the assembler versions, which leave out the
+// lowest partial products, so the last bit may differ
+#define MultiU16X8toH16(intRes, charIn1, intIn2) \
+  intRes = (unsigned short)(((unsigned long)(charIn1) * (intIn2) + 0x8000UL) >> 16)
+#define MultiU24X24toH16(intRes, longIn1, longIn2) \
+  intRes = (unsigned short)(((unsigned long long)(longIn1) * (longIn2) + 0x800000ULL) >> 24)
+#endif
 
 // Some useful constants
 
@@ -193,6 +255,98 @@ void enable_endstops(bool check)
   check_endstops = check;
 }
 
+#ifdef STEPPER_ISR_PROFILE
+// Called from the stepper ISR with interrupts disabled. Every interrupt is recorded, the slow
+// ones that missed their deadline too, and counted in missed as well. The durations include the
+// interrupts that nested in it (USART RX, timer 0), as the ISR runs with interrupts enabled.
+// If the counter wrapped, it did so at the OCR1A the ISR set, and that period is added. The
+// sample is off by the difference if the part before the new OCR1A already outlasted the old
+// one (it wrapped there), and a period short if the counter wrapped twice. For one tick after
+// the match the counter still shows OCR1A, it has not started over yet.
+FORCE_INLINE void isr_profile_record(unsigned short exit_ticks)
+{
+  unsigned short ticks = exit_ticks - isr_profile_entry;
+  if(ISR_PROFILE_MISSED(exit_ticks)) {
+    isr_profile_missed++;
+    if(ISR_PROFILE_WRAPPED && exit_ticks != ISR_PROFILE_TOP) {
+      // From the exit count, which may be below the entry count once it started over
+      unsigned long wrapped = (unsigned long)exit_ticks + ISR_PROFILE_TOP + 1 - isr_profile_entry;
+      ticks = (wrapped > 0xFFFF) ? 0xFFFF : wrapped;
+    }
+  }
+  if(isr_profile_entry > isr_profile_max_latency)
+    isr_profile_max_latency = isr_profile_entry;
+  if(isr_profile_phase >= ISR_PHASES)
+    return;
+
+  isr_profile_t *p = &isr_profile[isr_profile_phase];
+  if(ticks < p->min_ticks) p->min_ticks = ticks;
+  if(ticks > p->max_ticks) p->max_ticks = ticks;
+  p->sum_ticks += ticks;
+  p->count++;
+
+  unsigned char bucket = 0;
+  for(unsigned short t = ticks >> ISR_PROFILE_BUCKET0_SHIFT; t != 0 && bucket < ISR_PROFILE_BUCKETS - 1; t >>= 1)
+    bucket++;
+  if(p->hist[bucket] != 0xFFFF)
+    p->hist[bucket]++;
+}
+
+void st_profile_reset()
+{
+  CRITICAL_SECTION_START;
+  memset(isr_profile, 0, sizeof(isr_profile));
+  for(int8_t i=0; i < ISR_PHASES; i++)
+    isr_profile[i].min_ticks = 0xFFFF;
+  isr_profile_missed = 0;
+  isr_profile_max_latency = 0;
+  CRITICAL_SECTION_END;
+  #if defined(GALVO_SS_PIN) && !defined(GALVO_USART_SPI)
+    spi_dac_profile_reset();
+  #endif
+}
+
+void st_profile_report()
+{
+  SERIAL_ECHO_START;
+  SERIAL_ECHOLNPGM("Stepper ISR profile, timer ticks of 0.5us:");
+  for(int8_t i=0; i < ISR_PHASES; i++) {
+    isr_profile_t p;
+    CRITICAL_SECTION_START;
+    p = isr_profile[i];
+    CRITICAL_SECTION_END;
+
+    SERIAL_ECHO_START;
+    serialprintPGM(isr_phase_names[i]);
+    SERIAL_ECHOPAIR(" n:", p.count);
+    if(p.count > 0) {
+      SERIAL_ECHOPAIR(" min:", (unsigned long)p.min_ticks);
+      SERIAL_ECHOPAIR(" avg:", p.sum_ticks / p.count);
+      SERIAL_ECHOPAIR(" max:", (unsigned long)p.max_ticks);
+    }
+    SERIAL_ECHOPGM(" hist:");
+    for(int8_t b=0; b < ISR_PROFILE_BUCKETS; b++) {
+      if(b > 0) SERIAL_ECHOPGM(",");
+      SERIAL_ECHO(p.hist[b]);
+    }
+    SERIAL_ECHOLN("");
+  }
+  unsigned long missed;
+  unsigned short latency;
+  CRITICAL_SECTION_START;
+  missed = isr_profile_missed;
+  latency = isr_profile_max_latency;
+  CRITICAL_SECTION_END;
+  SERIAL_ECHO_START;
+  SERIAL_ECHOPAIR("missed:", missed);
+  SERIAL_ECHOPAIR(" max latency:", (unsigned long)latency);
+  #if defined(GALVO_SS_PIN) && !defined(GALVO_USART_SPI)
+    SERIAL_ECHOPAIR(" DAC held by SD max us:", spi_dac_max_held());
+  #endif
+  SERIAL_ECHOLN("");
+}
+#endif //STEPPER_ISR_PROFILE
+
 //         __________________________
 //        /|                        |\     _________________         ^
 //       / |                        | \   /|               |\        |
@@ -239,17 +393,16 @@ FORCE_INLINE unsigned short calc_timer(unsigned short step_rate) {
   if(step_rate < (F_CPU/500000)) step_rate = (F_CPU/500000);
   step_rate -= (F_CPU/500000); // Correct for minimal speed
   if(step_rate >= (8*256)){ // higher step rate 
-    unsigned short table_address = (unsigned short)&speed_lookuptable_fast[(unsigned char)(step_rate>>8)][0];
+    const uint16_t *table_entry = speed_lookuptable_fast[(unsigned char)(step_rate>>8)];
     unsigned char tmp_step_rate = (step_rate & 0x00ff);
-    unsigned short gain = (unsigned short)pgm_read_word_near(table_address+2);
+    unsigned short gain = (unsigned short)pgm_read_word_near(table_entry + 1);
     MultiU16X8toH16(timer, tmp_step_rate, gain);
-    timer = (unsigned short)pgm_read_word_near(table_address) - timer;
+    timer = (unsigned short)pgm_read_word_near(table_entry) - timer;
   }
   else { // lower step rates
-    unsigned short table_address = (unsigned short)&speed_lookuptable_slow[0][0];
-    table_address += ((step_rate)>>1) & 0xfffc;
-    timer = (unsigned short)pgm_read_word_near(table_address);
-    timer -= (((unsigned short)pgm_read_word_near(table_address+2) * (unsigned char)(step_rate & 0x0007))>>3);
+    const uint16_t *table_entry = speed_lookuptable_slow[step_rate >> 3];
+    timer = (unsigned short)pgm_read_word_near(table_entry);
+    timer -= (((unsigned short)pgm_read_word_near(table_entry + 1) * (unsigned char)(step_rate & 0x0007))>>3);
   }
   if(timer < 100) { timer = 100; MYSERIAL.print(MSG_STEPPER_TO_HIGH); MYSERIAL.println(step_rate); }//(20kHz this should never happen)
   return timer;
@@ -284,113 +437,130 @@ FORCE_INLINE void trapezoid_generator_reset() {
     
 }
 
-// "The Stepper Driver Interrupt" - This timer interrupt is the workhorse.  
-// It pops blocks from the block_buffer and executes them by pulsing the stepper pins appropriately. 
-ISR(TIMER1_COMPA_vect)
-{    
-  // If there is no current block, attempt to pop one from the buffer
-  if (current_block == NULL) {
-    // Anything in the buffer?
-    current_block = plan_get_current_block();
-    if (current_block != NULL) {
-      current_block->busy = true;
-      trapezoid_generator_reset();
-      counter_x = -(current_block->step_event_count >> 1);
-      counter_y = counter_x;
-      counter_rz = counter_x;
-      counter_lz = counter_x;
-      step_events_completed = 0; 
-      
-      #ifdef Z_LATE_ENABLE 
-        if(current_block->steps_rz > 0) {
-          enable_rz();
-          OCR1A = 2000; //1ms wait
-          return;
-        }
-      #endif
-      
-//      #ifdef ADVANCE
-//      lz_steps[current_block->active_extruder] = 0;
-//      #endif
-    } 
-    else {
-        OCR1A=2000; // 1kHz.
-    }    
-  } 
+// Latches the direction bits of the current block. Called once when a block is popped, so the
+// step loop only has to read count_direction[] and the DIR pins are not rewritten every step.
+FORCE_INLINE void set_stepper_direction() {
+  out_bits = current_block->direction_bits;
 
-  if (current_block != NULL) {
-    // Set directions TO DO This should be done once during init of trapezoid. Endstops -> interrupt
-    out_bits = current_block->direction_bits;
+  if ((out_bits & (1<<X_AXIS)) != 0) {   // stepping along -X axis
+    count_direction[X_AXIS]=-1;
+  }
+  else { // +direction 
+    count_direction[X_AXIS]=1;
+  }
 
-    // Set direction en check limit switches
-    if ((out_bits & (1<<X_AXIS)) != 0) {   // stepping along -X axis
-      count_direction[X_AXIS]=-1;
-    }
-    else { // +direction 
-      count_direction[X_AXIS]=1;
-    }
+  if ((out_bits & (1<<Y_AXIS)) != 0) {   // -direction
+    count_direction[Y_AXIS]=-1;
+  }
+  else { // +direction
+    count_direction[Y_AXIS]=1;
+  }
+
+  if ((out_bits & (1<<RZ_AXIS)) != 0) {   // -direction
+    WRITE(RZ_DIR_PIN,INVERT_RZ_DIR);
+    count_direction[RZ_AXIS]=-1;
+  }
+  else { // +direction
+    WRITE(RZ_DIR_PIN,!INVERT_RZ_DIR);
+    count_direction[RZ_AXIS]=1;
+  }
 
-    if ((out_bits & (1<<Y_AXIS)) != 0) {   // -direction
-      count_direction[Y_AXIS]=-1;
+  #ifndef ADVANCE
+    if ((out_bits & (1<<LZ_AXIS)) != 0) {  // -direction
+      REV_LZ_DIR();
+      count_direction[LZ_AXIS]=-1;
     }
     else { // +direction
-      count_direction[Y_AXIS]=1;
+      NORM_LZ_DIR();
+      count_direction[LZ_AXIS]=1;
     }
+  #endif //!ADVANCE
+}
 
-    if ((out_bits & (1<<RZ_AXIS)) != 0) {   // -direction
-      WRITE(RZ_DIR_PIN,INVERT_RZ_DIR);
-      
-      count_direction[RZ_AXIS]=-1;
-      CHECK_ENDSTOPS
-      {
-        #if Z_MIN_PIN > -1
-          bool z_min_endstop=(READ(Z_MIN_PIN) != Z_ENDSTOPS_INVERTING);
-          if(z_min_endstop && old_z_min_endstop && (current_block->steps_rz > 0)) {
-            endstops_trigsteps[RZ_AXIS] = count_position[RZ_AXIS];
-            endstop_z_hit=true;
-            step_events_completed = current_block->step_event_count;
-          }
-          old_z_min_endstop = z_min_endstop;
-        #endif
+// Checks the Z endstop in the direction of travel and ends the block when it is hit.
+FORCE_INLINE void check_z_endstops()
+{
+  if (count_direction[RZ_AXIS] < 0) {
+    #if Z_MIN_PIN > -1
+      bool z_min_endstop=(READ(Z_MIN_PIN) != Z_ENDSTOPS_INVERTING);
+      if(z_min_endstop && old_z_min_endstop) {
+        endstops_trigsteps[RZ_AXIS] = count_position[RZ_AXIS];
+        endstop_z_hit=true;
+        step_events_completed = current_block->step_event_count;
       }
-    }
-    else { // +direction
-      WRITE(RZ_DIR_PIN,!INVERT_RZ_DIR);
-
-      count_direction[RZ_AXIS]=1;
-      CHECK_ENDSTOPS
-      {
-        #if Z_MAX_PIN > -1
-          bool z_max_endstop=(READ(Z_MAX_PIN) != Z_ENDSTOPS_INVERTING);
-          if(z_max_endstop && old_z_max_endstop && (current_block->steps_rz > 0)) {
-            endstops_trigsteps[RZ_AXIS] = count_position[RZ_AXIS];
-            endstop_z_hit=true;
-            step_events_completed = current_block->step_event_count;
-          }
-          old_z_max_endstop = z_max_endstop;
-        #endif
+      old_z_min_endstop = z_min_endstop;
+    #endif
+  }
+  else {
+    #if Z_MAX_PIN > -1
+      bool z_max_endstop=(READ(Z_MAX_PIN) != Z_ENDSTOPS_INVERTING);
+      if(z_max_endstop && old_z_max_endstop) {
+        endstops_trigsteps[RZ_AXIS] = count_position[RZ_AXIS];
+        endstop_z_hit=true;
+        step_events_completed = current_block->step_event_count;
       }
+      old_z_max_endstop = z_max_endstop;
+    #endif
+  }
+}
+
+// Bresenham step of the galvo axes. The kinematics are fixed at compile time.
+FORCE_INLINE void step_xy()
+{
+  #if !defined COREXY
+    counter_x += current_block->steps_x;
+    if (counter_x > 0) {
+      counter_x -= current_block->step_event_count;
+      count_position[X_AXIS]+=count_direction[X_AXIS];   
+      update_X_galvo(count_direction[X_AXIS]);
     }
 
-    #ifndef ADVANCE
-      if ((out_bits & (1<<LZ_AXIS)) != 0) {  // -direction
-        REV_LZ_DIR();
-        count_direction[LZ_AXIS]=-1;
-      }
-      else { // +direction
-        NORM_LZ_DIR();
-        count_direction[LZ_AXIS]=1;
-      }
-    #endif //!ADVANCE
+    counter_y += current_block->steps_y;
+    if (counter_y > 0) {
+      counter_y -= current_block->step_event_count;
+      count_position[Y_AXIS]+=count_direction[Y_AXIS]; 
+      update_Y_galvo(count_direction[Y_AXIS]);
+    }
+  #else
+    counter_x += current_block->steps_x;        
+    counter_y += current_block->steps_y;
     
-
+    if ((counter_x > 0)&&!(counter_y>0)){  //X step only
+      counter_x -= current_block->step_event_count; 
+      count_position[X_AXIS]+=count_direction[X_AXIS];   
+      update_X_galvo(count_direction[X_AXIS]);
+    }
     
-    for(int8_t i=0; i < step_loops; i++) { // Take multiple steps per interrupt (For high speed moves) 
-      #if !defined(__AVR_AT90USB1286__) && !defined(__AVR_AT90USB1287__)
-      MSerial.checkRx(); // Check for serial chars.
-      #endif 
-      
-      #ifdef ADVANCE
+    if (!(counter_x > 0)&&(counter_y>0)){  //Y step only
+      counter_y -= current_block->step_event_count; 
+      count_position[Y_AXIS]+=count_direction[Y_AXIS];
+      update_Y_galvo(count_direction[Y_AXIS]);
+    }        
+    
+    if ((counter_x > 0)&&(counter_y>0)){  //step in both axes
+      counter_x -= current_block->step_event_count;
+      count_position[X_AXIS]+=count_direction[X_AXIS];
+      count_position[Y_AXIS]+=count_direction[Y_AXIS];
+      update_X_galvo(count_direction[X_AXIS]);
+      update_Y_galvo(count_direction[Y_AXIS]);
+      counter_y -= current_block->step_event_count;
+    }
+  #endif //COREXY
+}
+
+// The step loop of one interrupt, specialized per block at activation (see select_step_loop()).
+// Z_ACTIVE: the block moves RZ and/or LZ. ENDSTOPS: the block moves Z with endstop checking on.
+// An XY-only exposure block runs step_loop<false,false> without any Z or endstop code.
+template<bool Z_ACTIVE, bool ENDSTOPS>
+void step_loop()
+{
+  if (ENDSTOPS) {
+    check_z_endstops();
+  }
+
+  for(int8_t i=0; i < step_loops; i++) { // Take multiple steps per interrupt (For high speed moves) 
+    #ifdef ADVANCE
+    if (Z_ACTIVE) {
       counter_lz += current_block->steps_lz;
       if (counter_lz > 0) {
         counter_lz -= current_block->step_event_count;
@@ -400,81 +570,13 @@ ISR(TIMER1_COMPA_vect)
         else {
           lz_steps[current_block->active_extruder]++;
         }
-      }    
-      #endif //ADVANCE
-      
-   #if OPENSL_PRINT_MODE == 0
-      
-      
-      #if !defined COREXY      
-      counter_x += current_block->steps_x;
-      if (counter_x > 0) {
-        counter_x -= current_block->step_event_count;
-        count_position[X_AXIS]+=count_direction[X_AXIS];   
-        update_X_galvo(count_direction[X_AXIS]);
       }
+    }
+    #endif //ADVANCE
 
-      counter_y += current_block->steps_y;
-      if (counter_y > 0) {
-        counter_y -= current_block->step_event_count;
-        count_position[Y_AXIS]+=count_direction[Y_AXIS]; 
-        update_Y_galvo(count_direction[Y_AXIS]);
-      }
-      #endif
-  
-      #ifdef COREXY
-        counter_x += current_block->steps_x;        
-        counter_y += current_block->steps_y;
-        
-        if ((counter_x > 0)&&!(counter_y>0)){  //X step only
-          counter_x -= current_block->step_event_count; 
-          count_position[X_AXIS]+=count_direction[X_AXIS];   
-          update_X_galvo(count_direction[X_AXIS]);
-          
-        }
-        
-        if (!(counter_x > 0)&&(counter_y>0)){  //Y step only
-          counter_y -= current_block->step_event_count; 
-          count_position[Y_AXIS]+=count_direction[Y_AXIS];
-          update_Y_galvo(count_direction[Y_AXIS]);
-        }        
-        
-        if ((counter_x > 0)&&(counter_y>0)){  //step in both axes
-          if (((out_bits & (1<<X_AXIS)) == 0)^((out_bits & (1<<Y_AXIS)) == 0)){  //X and Y in different directions
-            counter_x -= current_block->step_event_count;  
-            //step_wait();
-            count_position[X_AXIS]+=count_direction[X_AXIS];
-            count_position[Y_AXIS]+=count_direction[Y_AXIS];
-            update_X_galvo(count_direction[X_AXIS]);
-            update_Y_galvo(count_direction[Y_AXIS]);
-            counter_y -= current_block->step_event_count;
-          }
-          else{  //X and Y in same direction
-            counter_x -= current_block->step_event_count;    
-            //step_wait();
-            count_position[X_AXIS]+=count_direction[X_AXIS];
-            count_position[Y_AXIS]+=count_direction[Y_AXIS];
-            update_X_galvo(count_direction[X_AXIS]);
-            update_Y_galvo(count_direction[Y_AXIS]);
-            counter_y -= current_block->step_event_count;    
-          }
-        }
-      #endif //corexy
+    step_xy();
 
-   #else
-      //Scanning X&Y With Galvos!
-        
-      unsigned long old_x = Galvo_WorldXPosition;
-      unsigned long old_y = Galvo_WorldYPosition;
-      
-      Galvo_WorldXPosition = Galvo_WorldXPosition + (count_direction[X_AXIS] * current_block->steps_x);
-      Galvo_WorldYPosition = Galvo_WorldYPosition + (count_direction[Y_AXIS] * current_block->steps_y);
-      
-      scan_X_Y_galvo(old_x, old_y, Galvo_WorldXPosition, Galvo_WorldYPosition);
-      
-      return;
-   #endif //OPENSL_PRINT_MODE
-      
+    if (Z_ACTIVE) {
       counter_rz += current_block->steps_rz;
       if (counter_rz > 0) {
         WRITE(RZ_STEP_PIN, !INVERT_RZ_STEP_PIN);
@@ -482,7 +584,6 @@ ISR(TIMER1_COMPA_vect)
         counter_rz -= current_block->step_event_count;
         count_position[RZ_AXIS]+=count_direction[RZ_AXIS];
         WRITE(RZ_STEP_PIN, INVERT_RZ_STEP_PIN);
-        
       }
 
       #ifndef ADVANCE
@@ -494,14 +595,122 @@ ISR(TIMER1_COMPA_vect)
           WRITE_LZ_STEP(INVERT_LZ_STEP_PIN);
         }
       #endif //!ADVANCE
-      step_events_completed += 1;  
-      if(step_events_completed >= current_block->step_event_count) break;
     }
+    step_events_completed += 1;  
+    if(step_events_completed >= current_block->step_event_count) break;
+  }
+}
+
+#if LASER_PIN > -1
+static unsigned char laser_output = 0; // Power last written to LASER_PIN
+static bool laser_from_block = false;  // laser_output is the power of a block, not the idle power
+
+FORCE_INLINE void write_laser(unsigned char power)
+{
+  if(power != laser_output) {
+    laser_output = power;
+    analogWrite(LASER_PIN, power);
+  }
+}
+
+void st_set_laser_power(unsigned char power)
+{
+  CRITICAL_SECTION_START;
+  laser_from_block = false;
+  write_laser(power);
+  CRITICAL_SECTION_END;
+}
+#endif
+
+typedef void (*step_loop_t)();
+static step_loop_t current_step_loop; // Specialization of step_loop() for current_block
+
+// Endstop checking is latched here, so enable_endstops() takes effect from the next block on.
+FORCE_INLINE step_loop_t select_step_loop()
+{
+  if (current_block->steps_rz == 0 && current_block->steps_lz == 0)
+    return &step_loop<false, false>;
+  if (check_endstops && current_block->steps_rz > 0)
+    return &step_loop<true, true>;
+  return &step_loop<true, false>;
+}
+
+// "The Stepper Driver Interrupt" - This timer interrupt is the workhorse.  
+// It pops blocks from the block_buffer and executes them by pulsing the stepper pins appropriately. 
+// The body runs with global interrupts enabled (see ISR(TIMER1_COMPA_vect) below).
+FORCE_INLINE void stepper_interrupt()
+{    
+  // If there is no current block, attempt to pop one from the buffer
+  if (current_block == NULL) {
+    // Anything in the buffer?
+    current_block = plan_get_current_block();
+    if (current_block != NULL) {
+      current_block->busy = true;
+      ISR_PROFILE_PHASE(ISR_PHASE_POP);
+      trapezoid_generator_reset();
+      counter_x = -(current_block->step_event_count >> 1);
+      counter_y = counter_x;
+      counter_rz = counter_x;
+      counter_lz = counter_x;
+      step_events_completed = 0; 
+      set_stepper_direction();
+      current_step_loop = select_step_loop();
+      #if LASER_PIN > -1
+        write_laser(current_block->laser_power); // Exactly at the boundary to the previous block
+        laser_from_block = true;
+      #endif
+      
+      #ifdef Z_POWER_MANAGEMENT
+        // manage_z_power() normally had Z on long before. Only a late estimate gets here, no stall.
+        if(current_block->steps_rz > 0 || current_block->steps_lz > 0) {
+          enable_rz();
+          enable_lz();
+        }
+      #elif defined(Z_LATE_ENABLE)
+        if(current_block->steps_rz > 0) {
+          enable_rz();
+          OCR1A = 2000; //1ms wait
+          return;
+        }
+      #endif
+    } 
+    else {
+        #if LASER_PIN > -1
+          // The queue ran dry: off now, not at the power of the last move until the main loop looks
+          if(laser_from_block) {
+            laser_from_block = false;
+            write_laser(0);
+          }
+        #endif
+        OCR1A=2000; // 1kHz.
+    }    
+  } 
+
+  if (current_block != NULL) {
+   #if OPENSL_PRINT_MODE == 0
+    current_step_loop();
+   #else
+    //Scanning X&Y With Galvos!
+    CHECK_ENDSTOPS
+    {
+      if (current_block->steps_rz > 0) check_z_endstops();
+    }
+
+    unsigned long old_x = Galvo_WorldXPosition;
+    unsigned long old_y = Galvo_WorldYPosition;
+    
+    Galvo_WorldXPosition = Galvo_WorldXPosition + (count_direction[X_AXIS] * current_block->steps_x);
+    Galvo_WorldYPosition = Galvo_WorldYPosition + (count_direction[Y_AXIS] * current_block->steps_y);
+    
+    scan_X_Y_galvo(old_x, old_y, Galvo_WorldXPosition, Galvo_WorldYPosition);
+    
+    return;
+   #endif //OPENSL_PRINT_MODE
     // Calculare new timer value
     unsigned short timer;
     unsigned short step_rate;
     if (step_events_completed <= (unsigned long int)current_block->accelerate_until) {
-      
+      ISR_PROFILE_PHASE(ISR_PHASE_ACCEL);
       MultiU24X24toH16(acc_step_rate, acceleration_time, current_block->acceleration_rate);
       acc_step_rate += current_block->initial_rate;
       
@@ -525,6 +734,7 @@ ISR(TIMER1_COMPA_vect)
       #endif
     } 
     else if (step_events_completed > (unsigned long int)current_block->decelerate_after) {   
+      ISR_PROFILE_PHASE(ISR_PHASE_DECEL);
       MultiU24X24toH16(step_rate, deceleration_time, current_block->acceleration_rate);
       
       if(step_rate > acc_step_rate) { // Check step_rate stays positive
@@ -553,6 +763,7 @@ ISR(TIMER1_COMPA_vect)
       #endif //ADVANCE
     }
     else {
+      ISR_PROFILE_PHASE(ISR_PHASE_CRUISE);
       OCR1A = OCR1A_nominal;
     }
 
@@ -564,6 +775,20 @@ ISR(TIMER1_COMPA_vect)
   } 
 }
 
+// Only this vector is masked while the step loop runs. Global interrupts are enabled again
+// right away, so the USART RX vector keeps draining the serial port (and millis() keeps
+// counting) even during long galvo moves.
+ISR(TIMER1_COMPA_vect)
+{
+  ISR_PROFILE_START();
+  DISABLE_STEPPER_DRIVER_INTERRUPT();
+  sei();
+  stepper_interrupt();
+  cli();
+  ISR_PROFILE_END();
+  ENABLE_STEPPER_DRIVER_INTERRUPT();
+}
+
 #ifdef ADVANCE
   unsigned char old_OCR0A;
   // Timer interrupt for E. lz_steps is set in the main routine;
@@ -677,6 +902,10 @@ void st_init()
     TIMSK0 |= (1<<OCIE0A);
   #endif //ADVANCE
   
+  #ifdef STEPPER_ISR_PROFILE
+    st_profile_reset();
+  #endif
+
   enable_endstops(true); // Start with endstops active. After homing they can be disabled
   sei();
 }
@@ -691,13 +920,8 @@ void st_synchronize()
 }
 
 void digitalPotWrite(int channel, int value) {
-  // take the SS pin low to select the chip:
-  digitalWrite(GALVO_SS_PIN,LOW);
-  //  send in the address and value via SPI:
-  SPI.transfer(channel);
-  SPI.transfer(value);
-  // take the SS pin high to de-select the chip:
-  digitalWrite(GALVO_SS_PIN,HIGH);
+  // shares the SPI with the SD card, see spibus.h
+  spi_dac_write(channel, value);
 }
 
 void scan_X_Y_galvo(unsigned long x1, unsigned long y1, unsigned long x2, unsigned long y2)
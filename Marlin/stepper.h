@@ -70,6 +70,15 @@ void checkStepperErrors(); //Print errors detected by the stepper
 
 void finishAndDisableSteppers();
 
+#if LASER_PIN > -1
+void st_set_laser_power(unsigned char power); // Laser power while no block is running
+#endif
+
+#ifdef STEPPER_ISR_PROFILE
+void st_profile_report(); // Print per phase stepper ISR timings (M603)
+void st_profile_reset();
+#endif
+
 extern block_t *current_block;  // A pointer to the block currently being traced
 
 void quickStop();
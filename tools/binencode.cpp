@@ -0,0 +1,191 @@
+/*
+  binencode - reference encoder for the binary move frames of ../Marlin/binprotocol.h, which
+  firmware built with BINARY_PROTOCOL accepts after M610
+
+  Converts the moves of a G-code file into frames:
+    binencode input.gcode output.bin
+
+  Understood are G0/G1 with X, Y, Z, F and S (laser power), G90, M600 [S], M601 and comments.
+  Anything else can not be expressed in frames and has to be sent as G-code before M610;
+  such lines are reported and skipped. Frames are numbered from 0, as the firmware expects
+  right after M610, and the last frame ends with BIN_REC_END. The first move is sent with
+  absolute XY (missing words count as 0), later ones as deltas where they fit.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "../Marlin/binprotocol.h"
+
+static FILE *out;
+static uint8_t payload[BIN_MAX_PAYLOAD];
+static uint8_t payload_len;
+static uint8_t seq;
+static unsigned long frames, records, bytes;
+
+static void flush_frame()
+{
+  if(payload_len == 0)
+    return;
+  uint8_t frame[BIN_HEADER_SIZE + BIN_MAX_PAYLOAD + BIN_CRC_SIZE];
+  frame[0] = BIN_SYNC;
+  frame[1] = seq++;
+  frame[2] = payload_len;
+  memcpy(frame + BIN_HEADER_SIZE, payload, payload_len);
+  uint16_t crc = bin_crc16(frame + 1, payload_len + 2);
+  frame[BIN_HEADER_SIZE + payload_len] = crc & 0xFF;
+  frame[BIN_HEADER_SIZE + payload_len + 1] = crc >> 8;
+  size_t n = BIN_HEADER_SIZE + payload_len + BIN_CRC_SIZE;
+  fwrite(frame, 1, n, out);
+  bytes += n;
+  frames++;
+  payload_len = 0;
+}
+
+// Starts a record of the given size, in a new frame if the current one is full
+static uint8_t *add_record(uint8_t type, uint8_t size)
+{
+  if(payload_len + size > BIN_MAX_PAYLOAD)
+    flush_frame();
+  uint8_t *p = payload + payload_len;
+  payload_len += size;
+  p[0] = type;
+  records++;
+  return p;
+}
+
+static void put_long(uint8_t *p, long v)
+{
+  unsigned long u = (unsigned long)v;
+  p[0] = u & 0xFF; p[1] = (u >> 8) & 0xFF; p[2] = (u >> 16) & 0xFF; p[3] = (u >> 24) & 0xFF;
+}
+
+static void put_int(uint8_t *p, int v)
+{
+  p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF;
+}
+
+static float feedrates[BIN_FEEDRATES];
+static int feedrate_count;
+static int feedrate_oldest;
+
+// Index of the feedrate in the firmware table, defining it on first use. When the table is
+// full the least recently defined entry is replaced.
+static uint8_t feedrate_index(float f)
+{
+  for(int i = 0; i < feedrate_count; i++)
+    if(feedrates[i] == f) return i;
+  int i;
+  if(feedrate_count < BIN_FEEDRATES)
+    i = feedrate_count++;
+  else {
+    i = feedrate_oldest;
+    feedrate_oldest = (feedrate_oldest + 1) % BIN_FEEDRATES;
+  }
+  feedrates[i] = f;
+  uint8_t *p = add_record(BIN_REC_FEEDRATE, BIN_REC_FEEDRATE_SIZE);
+  p[1] = i;
+  memcpy(p + 2, &f, sizeof(f));
+  return i;
+}
+
+// Value of the first word with this letter, like the firmware's code_seen()
+static bool word(const char *line, char letter, float *value)
+{
+  const char *p = strchr(line, letter);
+  if(p == NULL) return false;
+  *value = strtof(p + 1, NULL);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if(argc != 3) {
+    fprintf(stderr, "usage: %s input.gcode output.bin\n", argv[0]);
+    return 1;
+  }
+  FILE *in = fopen(argv[1], "r");
+  if(in == NULL) { perror(argv[1]); return 1; }
+  out = fopen(argv[2], "wb");
+  if(out == NULL) { perror(argv[2]); return 1; }
+
+  long pos[2] = {0, 0};   // Micrometres
+  float z = 0, feed = 1500, v;
+  bool z_known = false, pos_known = false;
+  uint8_t laser = 0;
+  unsigned long line_nr = 0, skipped = 0, in_bytes = 0;
+  char line[256];
+
+  while(fgets(line, sizeof(line), in)) {
+    line_nr++;
+    in_bytes += strlen(line);
+    char *c = strchr(line, ';');
+    if(c) *c = '\0';
+    for(c = line; *c; c++) *c = toupper(*c);
+    char *s = line;
+    while(isspace(*s)) s++;
+    if(*s == '\0') continue;
+
+    if(word(s, 'G', &v) && (v == 0 || v == 1)) {
+      long target[2] = {pos[0], pos[1]};
+      if(word(s, 'X', &v)) target[0] = lround(v * 1000.0);
+      if(word(s, 'Y', &v)) target[1] = lround(v * 1000.0);
+      if(word(s, 'F', &v) && v > 0) feed = v;
+      if(word(s, 'S', &v)) laser = (uint8_t)fmaxf(0, fminf(255, v));
+      uint8_t f = feedrate_index(feed);
+      if(word(s, 'Z', &v) && (!z_known || v != z)) {
+        if(target[0] != pos[0] || target[1] != pos[1]) {
+          fprintf(stderr, "%lu: XY and Z in one move, split into two\n", line_nr);
+          uint8_t *p = add_record(BIN_REC_MOVE, BIN_REC_MOVE_SIZE);
+          put_long(p + 1, target[0]); put_long(p + 5, target[1]);
+          p[9] = laser; p[10] = f;
+          pos[0] = target[0]; pos[1] = target[1];
+          pos_known = true;
+        }
+        z = v;
+        z_known = true;
+        uint8_t *p = add_record(BIN_REC_MOVE_Z, BIN_REC_MOVE_Z_SIZE);
+        put_long(p + 1, lround(z * 1000.0)); put_long(p + 5, lround(z * 1000.0));
+        p[9] = f;
+        continue;
+      }
+      long dx = target[0] - pos[0], dy = target[1] - pos[1];
+      if(pos_known && dx >= -32768 && dx <= 32767 && dy >= -32768 && dy <= 32767) {
+        uint8_t *p = add_record(BIN_REC_DELTA, BIN_REC_DELTA_SIZE);
+        put_int(p + 1, dx); put_int(p + 3, dy);
+        p[5] = laser; p[6] = f;
+      }
+      else {
+        uint8_t *p = add_record(BIN_REC_MOVE, BIN_REC_MOVE_SIZE);
+        put_long(p + 1, target[0]); put_long(p + 5, target[1]);
+        p[9] = laser; p[10] = f;
+      }
+      pos[0] = target[0]; pos[1] = target[1];
+      pos_known = true;
+    }
+    else if(word(s, 'G', &v) && v == 90) {
+      // Absolute positions are all frames know
+    }
+    else if(word(s, 'M', &v) && v == 600) {
+      laser = word(s, 'S', &v) ? (uint8_t)fmaxf(0, fminf(255, v)) : 255;
+    }
+    else if(word(s, 'M', &v) && v == 601) {
+      laser = 0;
+    }
+    else {
+      fprintf(stderr, "%lu: not expressible as frame, skipped: %s\n", line_nr, s);
+      skipped++;
+    }
+  }
+  add_record(BIN_REC_END, BIN_REC_END_SIZE);
+  flush_frame();
+  fclose(in);
+  fclose(out);
+
+  fprintf(stderr, "%lu lines, %lu bytes -> %lu records in %lu frames, %lu bytes (%.1f%%), %lu lines skipped\n",
+    line_nr, in_bytes, records, frames, bytes, in_bytes ? 100.0 * bytes / in_bytes : 0.0, skipped);
+  return 0;
+}
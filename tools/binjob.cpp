@@ -0,0 +1,288 @@
+/*
+  binjob - converts G-code into an SD job of binary records (see ../Marlin/binprotocol.h),
+  printed by firmware built with SD_BINARY_JOB
+    binjob input.gcode output.gb
+
+  The job is printed with M23/M24 like G-code, but its moves go straight into the planner.
+  Give it a name with an extension starting with G (PART.GB), otherwise M20 does not list it.
+
+  Understood are G0/G1 with X, Y, Z, F and S (laser power), G90, G91, M600 [S], M601 and
+  comments, like binencode. Anything else can not be expressed in records; such lines are
+  reported and skipped, send them before M24 (G28 for example). A new layer starts with the
+  first Z move after XY moves. Every layer begins with an absolute move and defines the
+  feedrates it uses, so M26 L<layer> can start the print there.
+
+  The header carries the layer count, the layer table, the layer thickness (the most common
+  Z step between layers) and the most common feedrates of moves with the laser off (jump)
+  and on (mark), which the firmware presets as feedrate index 0 and 1.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <map>
+#include <vector>
+
+#include "../Marlin/binprotocol.h"
+
+// What the G-code does, collected before the records are written
+struct op {
+  enum { XY, Z, LAYER } type;
+  long x, y, z;        // Micrometres
+  uint8_t laser;
+  float feed;
+};
+static std::vector<op> ops;
+
+static std::vector<uint8_t> out;
+static unsigned long records;
+
+static uint8_t *add_record(uint8_t type, uint8_t size)
+{
+  out.resize(out.size() + size);
+  uint8_t *p = &out[out.size() - size];
+  p[0] = type;
+  records++;
+  return p;
+}
+
+static void put_long(uint8_t *p, long v)
+{
+  unsigned long u = (unsigned long)v;
+  p[0] = u & 0xFF; p[1] = (u >> 8) & 0xFF; p[2] = (u >> 16) & 0xFF; p[3] = (u >> 24) & 0xFF;
+}
+
+static void put_int(uint8_t *p, int v)
+{
+  p[0] = v & 0xFF; p[1] = (v >> 8) & 0xFF;
+}
+
+// Index 0 and 1 come from the header, 2.. are defined in the layer that uses them. When the
+// table is full the least recently defined entry is replaced.
+static float jump_feed, mark_feed;
+static float feedrates[BIN_FEEDRATES];
+static int feedrate_count;
+static int feedrate_oldest;
+
+static void reset_feedrates()
+{
+  feedrate_count = 2;
+  feedrate_oldest = 2;
+}
+
+static uint8_t feedrate_index(float f)
+{
+  if(f == jump_feed) return 0;
+  if(f == mark_feed) return 1;
+  for(int i = 2; i < feedrate_count; i++)
+    if(feedrates[i] == f) return i;
+  int i;
+  if(feedrate_count < BIN_FEEDRATES)
+    i = feedrate_count++;
+  else {
+    i = feedrate_oldest;
+    feedrate_oldest = (feedrate_oldest + 1 < BIN_FEEDRATES) ? feedrate_oldest + 1 : 2;
+  }
+  feedrates[i] = f;
+  uint8_t *p = add_record(BIN_REC_FEEDRATE, BIN_REC_FEEDRATE_SIZE);
+  p[1] = i;
+  memcpy(p + 2, &f, sizeof(f));
+  return i;
+}
+
+// Most frequent key, 0 if there is none
+template<class T> static T most_common(const std::map<T, unsigned long> &count)
+{
+  T best = 0;
+  unsigned long n = 0;
+  for(typename std::map<T, unsigned long>::const_iterator i = count.begin(); i != count.end(); ++i)
+    if(i->second > n) { best = i->first; n = i->second; }
+  return best;
+}
+
+// Value of the first word with this letter, like the firmware's code_seen()
+static bool word(const char *line, char letter, float *value)
+{
+  const char *p = strchr(line, letter);
+  if(p == NULL) return false;
+  *value = strtof(p + 1, NULL);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if(argc != 3) {
+    fprintf(stderr, "usage: %s input.gcode output.gb\n", argv[0]);
+    return 1;
+  }
+  FILE *in = fopen(argv[1], "r");
+  if(in == NULL) { perror(argv[1]); return 1; }
+
+  long pos[3] = {0, 0, 0};  // X, Y, Z in micrometres
+  float feed = 1500, v;
+  bool relative = false, xy_in_layer = false;
+  uint8_t laser = 0;
+  unsigned long line_nr = 0, skipped = 0, in_bytes = 0;
+  char line[256];
+
+  op layer0 = { op::LAYER, 0, 0, 0, 0, 0 };
+  ops.push_back(layer0);
+  while(fgets(line, sizeof(line), in)) {
+    line_nr++;
+    in_bytes += strlen(line);
+    char *c = strchr(line, ';');
+    if(c) *c = '\0';
+    for(c = line; *c; c++) *c = toupper(*c);
+    char *s = line;
+    while(isspace(*s)) s++;
+    char *e = s + strlen(s);
+    while(e > s && isspace(e[-1])) *--e = '\0';
+    if(*s == '\0') continue;
+
+    if(word(s, 'G', &v) && (v == 0 || v == 1)) {
+      static const char letters[3] = {'X', 'Y', 'Z'};
+      long target[3] = {pos[0], pos[1], pos[2]};
+      bool seen[3];
+      for(int a = 0; a < 3; a++) {
+        seen[a] = word(s, letters[a], &v);
+        if(seen[a]) target[a] = lround(v * 1000.0) + (relative ? pos[a] : 0);
+      }
+      if(word(s, 'F', &v) && v > 0) feed = v;
+      if(word(s, 'S', &v)) laser = (uint8_t)fmaxf(0, fminf(255, v));
+      if(seen[0] || seen[1]) {
+        op o = { op::XY, target[0], target[1], pos[2], laser, feed };
+        ops.push_back(o);
+        pos[0] = target[0]; pos[1] = target[1];
+        xy_in_layer = true;
+      }
+      if(seen[2] && target[2] != pos[2]) {
+        if(seen[0] || seen[1])
+          fprintf(stderr, "%lu: XY and Z in one move, split into two\n", line_nr);
+        if(xy_in_layer) {
+          op o = { op::LAYER, 0, 0, 0, 0, 0 };
+          ops.push_back(o);
+          xy_in_layer = false;
+        }
+        op o = { op::Z, pos[0], pos[1], target[2], laser, feed };
+        ops.push_back(o);
+        pos[2] = target[2];
+      }
+    }
+    else if(word(s, 'G', &v) && (v == 90 || v == 91)) {
+      relative = (v == 91);
+    }
+    else if(word(s, 'M', &v) && v == 600) {
+      laser = word(s, 'S', &v) ? (uint8_t)fmaxf(0, fminf(255, v)) : 255;
+    }
+    else if(word(s, 'M', &v) && v == 601) {
+      laser = 0;
+    }
+    else {
+      fprintf(stderr, "%lu: not expressible as record, skipped: %s\n", line_nr, s);
+      skipped++;
+    }
+  }
+  fclose(in);
+
+  // Header values, the Z of a layer is where its first XY move is made
+  std::map<float, unsigned long> jumps, marks;
+  std::map<long, unsigned long> steps;
+  long layer_z = 0;
+  bool layer_start = false, have_layer_z = false;
+  for(size_t i = 0; i < ops.size(); i++) {
+    if(ops[i].type == op::XY)
+      (ops[i].laser ? marks : jumps)[ops[i].feed]++;
+    if(ops[i].type == op::LAYER)
+      layer_start = true;
+    else if(layer_start && ops[i].type == op::XY) {
+      if(have_layer_z && ops[i].z > layer_z) steps[ops[i].z - layer_z]++;
+      layer_z = ops[i].z;
+      have_layer_z = true;
+      layer_start = false;
+    }
+  }
+  jump_feed = most_common(jumps);
+  mark_feed = most_common(marks);
+  if(mark_feed == jump_feed) mark_feed = 0;
+
+  // Records
+  out.resize(BIN_JOB_HEADER_SIZE);
+  std::vector<unsigned long> layers;
+  bool pos_known = false;
+  int laser_sent = -1;   // Power of the last XY record in this layer, -1 none yet
+  long last[2] = {0, 0};
+  for(size_t i = 0; i < ops.size(); i++) {
+    const op &o = ops[i];
+    if(o.type == op::LAYER) {
+      layers.push_back(out.size());
+      put_long(add_record(BIN_REC_LAYER, BIN_REC_LAYER_SIZE) + 1, layers.size() - 1);
+      reset_feedrates();
+      pos_known = false;
+      laser_sent = -1;
+      continue;
+    }
+    uint8_t f = feedrate_index(o.feed);
+    if(o.type == op::Z) {
+      // A Z move takes the power of the move before it, a change goes out with a move of 0
+      if(laser_sent != o.laser) {
+        uint8_t *p = add_record(BIN_REC_DELTA, BIN_REC_DELTA_SIZE);
+        put_int(p + 1, 0); put_int(p + 3, 0);
+        p[5] = o.laser; p[6] = f;
+        laser_sent = o.laser;
+      }
+      uint8_t *p = add_record(BIN_REC_MOVE_Z, BIN_REC_MOVE_Z_SIZE);
+      put_long(p + 1, o.z); put_long(p + 5, o.z);
+      p[9] = f;
+      continue;
+    }
+    long dx = o.x - last[0], dy = o.y - last[1];
+    if(pos_known && dx >= -32768 && dx <= 32767 && dy >= -32768 && dy <= 32767) {
+      uint8_t *p = add_record(BIN_REC_DELTA, BIN_REC_DELTA_SIZE);
+      put_int(p + 1, dx); put_int(p + 3, dy);
+      p[5] = o.laser; p[6] = f;
+    }
+    else {
+      uint8_t *p = add_record(BIN_REC_MOVE, BIN_REC_MOVE_SIZE);
+      put_long(p + 1, o.x); put_long(p + 5, o.y);
+      p[9] = o.laser; p[10] = f;
+    }
+    last[0] = o.x; last[1] = o.y;
+    pos_known = true;
+    laser_sent = o.laser;
+  }
+  if(laser_sent != laser) { // M601 at the end
+    uint8_t *p = add_record(BIN_REC_DELTA, BIN_REC_DELTA_SIZE);
+    put_int(p + 1, 0); put_int(p + 3, 0);
+    p[5] = laser; p[6] = 0;
+  }
+  add_record(BIN_REC_END, BIN_REC_END_SIZE);
+
+  unsigned long table = out.size();
+  for(size_t i = 0; i < layers.size(); i++) {
+    out.resize(out.size() + 4);
+    put_long(&out[out.size() - 4], layers[i]);
+  }
+  uint8_t *h = &out[0];
+  memset(h, 0, BIN_JOB_HEADER_SIZE);
+  memcpy(h, BIN_JOB_MAGIC, 4);
+  h[4] = BIN_JOB_VERSION;
+  h[5] = BIN_JOB_HEADER_SIZE;
+  put_long(h + 8, layers.size());
+  put_long(h + 12, table);
+  put_long(h + 16, most_common(steps));
+  memcpy(h + 20, &jump_feed, sizeof(float));
+  memcpy(h + 24, &mark_feed, sizeof(float));
+
+  FILE *f = fopen(argv[2], "wb");
+  if(f == NULL) { perror(argv[2]); return 1; }
+  if(fwrite(&out[0], 1, out.size(), f) != out.size() || fclose(f) != 0) { perror(argv[2]); return 1; }
+
+  fprintf(stderr, "%lu lines, %lu bytes -> %lu layers, %lu records, %lu bytes (%.1f%%), %lu lines skipped\n",
+    line_nr, in_bytes, (unsigned long)layers.size(), records, (unsigned long)out.size(),
+    in_bytes ? 100.0 * out.size() / in_bytes : 0.0, skipped);
+  fprintf(stderr, "layer thickness %.3f mm, jump %g mm/min, mark %g mm/min\n",
+    most_common(steps) * 0.001, jump_feed, mark_feed);
+  return 0;
+}
@@ -0,0 +1,271 @@
+/*
+  fwtest - runs the command layer of the firmware on the host and checks what it does
+    fwtest
+
+  Marlin.ino is compiled into this program as it is, with the Arduino core, the SD card
+  (an empty FAT16 image in /tmp) and the planner replaced by the stand-ins in host/. The
+  commands go in through Serial like from a host program, plan_buffer_line() records the
+  moves. Prints the checks that failed and exits with 1 if there are any. "make check" runs it.
+  The Makefile turns on the optional features that are off in the default configuration.
+*/
+
+#include "../Marlin/Marlin.ino"
+#include "host/sdimage.h"
+#include "host/motion.h"
+
+#include <unistd.h>
+
+static int checks, failures;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+  checks++;
+  if(!ok) {
+    fprintf(stderr, "fwtest.cpp:%d: %s\n", line, what);
+    failures++;
+  }
+}
+
+// Sends text like a host program and runs loop() until the firmware has read and executed it
+static void send(const char *text)
+{
+  host_serial_input(text);
+  for(int i = 0; i < 10000 && (MYSERIAL.available() > 0 || buflen > 0); i++)
+    loop();
+}
+
+static bool output_has(const char *text)
+{
+  return strstr(host_serial_output(), text) != NULL;
+}
+
+static void print_sd_file()
+{
+  for(int i = 0; i < 100000 && card.sdprinting; i++)
+    loop();
+}
+
+//------------------------------------------------------------------------------
+// M23, M28 and M30 take the file name from the text of the line
+static void test_sd_files()
+{
+  host_serial_clear();
+  send("M28 TEST.G\n");
+  CHECK(output_has(MSG_SD_WRITE_TO_FILE "TEST.G"));
+  send("G1 X10 Y20 F600\nG1 X30\nM29\n");
+  CHECK(output_has(MSG_FILE_SAVED));
+  host_serial_clear();
+  send("M20\n");
+  CHECK(output_has(MSG_BEGIN_FILE_LIST "\nTEST.G\n" MSG_END_FILE_LIST));
+
+  host_serial_clear();
+  host_moves.clear();
+  send("M23 TEST.G\n");
+  CHECK(output_has(MSG_SD_FILE_SELECTED));
+  send("M24\n");
+  print_sd_file();
+  CHECK(output_has(MSG_FILE_PRINTED));
+  CHECK(host_moves.size() == 2 && host_moves[1].x == 30 && host_moves[1].y == 20);
+
+  #ifdef SD_BINARY_UPLOAD
+  host_serial_clear();
+  const char *bytes = "G1 X1 Y2\nG1 X3 Y4\n";
+  char m28[32];
+  snprintf(m28, sizeof(m28), "M28 B%u BIN.G\n", (unsigned)strlen(bytes));
+  host_serial_reply("BIN.G\n", bytes);  // Like sdupload, after "Writing to file"
+  send(m28);
+  CHECK(output_has(MSG_SD_WRITE_TO_FILE "BIN.G"));
+  CHECK(output_has(MSG_FILE_SAVED));
+  host_moves.clear();
+  send("M23 BIN.G\nM24\n");
+  print_sd_file();
+  CHECK(host_moves.size() == 2 && host_moves[1].x == 3 && host_moves[1].y == 4);
+  #endif
+
+  host_serial_clear();
+  send("M30 TEST.G\n");
+  CHECK(output_has("File deleted:TEST.G"));
+  host_serial_clear();
+  send("M23 TEST.G\n");
+  CHECK(output_has(MSG_SD_OPEN_FILE_FAIL "TEST.G"));
+}
+
+//------------------------------------------------------------------------------
+// An M28 upload that ends without M29 still ends its multiple block write and is cut to the
+// lines it got, not left at the preallocated size
+static void test_sd_upload_release()
+{
+  sd_image_reset_stats();
+  send("M28 CUT.G\nG1 X1\n");
+  CHECK(card.saving);
+  card.release();     // M22 from the LCD menu, M22 on the serial line goes into the file
+  CHECK(!card.saving);
+  CHECK(sd_stats.write_stops == sd_stats.write_starts);
+
+  host_serial_clear();
+  send("M21\nM23 CUT.G\n");
+  CHECK(output_has("CUT.G" MSG_SD_SIZE "7\n"));  // "G1 X1\r\n"
+  send("M30 CUT.G\n");
+}
+
+//------------------------------------------------------------------------------
+// Lines read from the SD card keep their N word and checksum, parse_command() skips them
+static void test_line_numbers()
+{
+  // Written directly: over serial line_scan() would take the N words and checksums off
+  char name[] = "NUM.G";
+  char text[] = "N1 G1 X5 Y6*99\nN2 G1 X7*98\n N3 M400\n";
+  card.openFile(name, false);
+  card.write_command(text);
+  card.closefile();
+  host_serial_clear();
+  host_moves.clear();
+  send("M23 NUM.G\nM24\n");
+  print_sd_file();
+  CHECK(!output_has(MSG_UNKNOWN_COMMAND));
+  CHECK(host_moves.size() == 2 && host_moves[0].x == 5 && host_moves[1].x == 7 && host_moves[1].y == 6);
+  send("M30 NUM.G\n");
+
+  // G-1 is not a move
+  host_moves.clear();
+  send("G-1 X50\n");
+  CHECK(host_moves.empty());
+}
+
+//------------------------------------------------------------------------------
+// The B of the ok counts lines of MAX_CMD_SIZE that fit into the free bytes of the queue
+static void test_advanced_ok()
+{
+  char expected[16];
+  host_serial_clear();
+  send("M400\n");  // Still queued while its ok is sent, but far from the end of the ring
+  snprintf(expected, sizeof(expected), " B%d\n", CMDQUEUE_SIZE / (MAX_CMD_SIZE + 2));
+  CHECK(output_has(expected));
+}
+
+#ifdef BINARY_PROTOCOL
+//------------------------------------------------------------------------------
+// Binary frames after M610: a bad record gets no ok, the laser power follows M604
+static void send_frame(uint8_t seq, const uint8_t *payload, uint8_t len)
+{
+  uint8_t frame[BIN_HEADER_SIZE + BIN_MAX_PAYLOAD + BIN_CRC_SIZE];
+  frame[0] = BIN_SYNC;
+  frame[1] = seq;
+  frame[2] = len;
+  memcpy(frame + BIN_HEADER_SIZE, payload, len);
+  uint16_t crc = bin_crc16(frame + 1, len + 2);
+  frame[BIN_HEADER_SIZE + len] = crc & 0xFF;
+  frame[BIN_HEADER_SIZE + len + 1] = crc >> 8;
+  host_serial_input(frame, BIN_HEADER_SIZE + len + BIN_CRC_SIZE);
+  for(int i = 0; i < 100 && MYSERIAL.available() > 0; i++)
+    loop();
+}
+
+static void test_binary_frames()
+{
+  send("G1 X0 Y0 F600\nM604 S1\nM600 S50\nM610\n");
+  host_serial_clear();
+  host_moves.clear();
+  const uint8_t moves[] = {
+    BIN_REC_DELTA, 0xE8, 0x03, 0, 0, 200, 0,   // X +1 mm at 200
+    BIN_REC_MOVE_Z, 0xD0, 0x07, 0, 0, 0xD0, 0x07, 0, 0, 0 };  // Z 2 mm, no power
+  send_frame(0, moves, sizeof(moves));
+  CHECK(output_has("ok 0"));
+  CHECK(host_moves.size() == 2 && host_moves[0].x == 1 && host_moves[0].laser == 200 && host_moves[1].laser == 0);
+  CHECK(LaserPower == 50);
+
+  host_serial_clear();
+  host_moves.clear();
+  const uint8_t bad[] = { BIN_REC_DELTA, 0xE8, 0x03, 0, 0, 0, 0, 0x55 };
+  send_frame(1, bad, sizeof(bad));
+  CHECK(output_has("Bad binary record in frame 1") && !output_has("ok 1"));
+  CHECK(host_moves.size() == 1);
+
+  const uint8_t end[] = { BIN_REC_END };
+  send_frame(2, end, sizeof(end));
+  CHECK(!bin_mode);
+  send("M604 S0\nM601\n");
+}
+#endif
+
+#ifdef SD_BINARY_JOB
+//------------------------------------------------------------------------------
+// An SD job with a bad record pauses and names the file position of that record
+static void test_binary_job_error()
+{
+  uint8_t job[BIN_JOB_HEADER_SIZE + BIN_REC_DELTA_SIZE + 1];
+  memset(job, 0, sizeof(job));
+  memcpy(job, BIN_JOB_MAGIC, 4);
+  job[4] = BIN_JOB_VERSION;
+  job[5] = BIN_JOB_HEADER_SIZE;
+  uint8_t *r = job + BIN_JOB_HEADER_SIZE;
+  r[0] = BIN_REC_DELTA;
+  r[BIN_REC_DELTA_SIZE] = 0x55;  // No record type
+  char name[] = "BAD.GB";
+  card.openFile(name, false);
+  card.write_data(job, sizeof(job));
+  card.closefile();
+
+  host_serial_clear();
+  send("M23 BAD.GB\nM24\n");
+  print_sd_file();
+  char expected[48];
+  snprintf(expected, sizeof(expected), "Bad binary record at byte %d\n", BIN_JOB_HEADER_SIZE + BIN_REC_DELTA_SIZE);
+  CHECK(output_has(expected));
+  send("M30 BAD.GB\n");
+}
+#endif
+
+#ifdef MACROS
+//------------------------------------------------------------------------------
+// A placeholder may take the word of another letter, X#Y is X from the Y of the M712
+static void test_macro_placeholders()
+{
+  send("G1 X1 Y1 F600\n");
+  send("M710 P0\nG1 X#Y R#Z\nM711\n");
+  host_moves.clear();
+  send("M712 P0 Y7 Z2\n");
+  CHECK(host_moves.size() == 1 && host_moves[0].x == 7 && host_moves[0].y == 1 && host_moves[0].rz == 2);
+  host_moves.clear();
+  send("M712 P0 Y8\n");
+  CHECK(host_moves.size() == 1 && host_moves[0].x == 8 && host_moves[0].y == 1 && host_moves[0].rz == 2);
+}
+#endif
+
+int main()
+{
+  char image[] = "/tmp/fwtestXXXXXX";
+  int fd = mkstemp(image);
+  if(fd < 0) { perror(image); return 1; }
+  close(fd);
+  if(!sd_image_format(image, 16) || !sd_image_open(image))
+    return 1;
+
+  setup();
+  send("M21\n");
+  if(!card.cardOK) {
+    fprintf(stderr, "M21 did not mount %s\n", image);
+    return 1;
+  }
+
+  test_sd_files();
+  test_sd_upload_release();
+  test_line_numbers();
+  #ifdef SD_BINARY_JOB
+  test_binary_job_error();
+  #endif
+  test_advanced_ok();
+  #ifdef BINARY_PROTOCOL
+  test_binary_frames();
+  #endif
+  #ifdef MACROS
+  test_macro_placeholders();
+  #endif
+
+  sd_image_close();
+  unlink(image);
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
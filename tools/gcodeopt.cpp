@@ -0,0 +1,296 @@
+/*
+  gcodeopt - rewrites slicer G-code into the shortest stream this firmware executes the same way
+    gcodeopt [-u] input.gcode output.gcode
+
+  - comments, blank lines, line numbers and checksums are removed (the host adds its own)
+  - X/Y/Z/R/L are rounded to whole steps of DEFAULT_AXIS_STEPS_PER_UNIT from
+    ../Marlin/Configuration.h and printed with just enough decimals to hit that step
+  - axis words that do not change the position, F words that do not change the feedrate and
+    moves that end up without any axis word are dropped
+  - laser changes (M600 [S], M601, G0/G1 S) are held back until the next line that is sent,
+    so a row of them collapses into the last one and a change to the current power disappears.
+    If that line is a move, also one passed on unchanged in relative mode, the change goes
+    into its S word instead of a line of its own (not after M604 S1, where the S of a move
+    does not carry over to the next one).
+  Regenerated lines are written without blanks ("G1X10.25Y3"), which the firmware parses alike.
+  Lines in relative mode (G91), arcs (G2/G3) and lines with unknown words are passed on
+  unchanged. The position is unknown after them and after G28, so the next move keeps all its
+  axis words. Like the firmware after a reset the file is taken to start in absolute mode; with
+  -u (the machine may be left in G91) moves are passed on unchanged until the first G90. If the
+  steps per unit were changed with M92, rebuild the tool with matching values.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "../Marlin/Configuration.h"
+
+static const double steps_per_unit[] = DEFAULT_AXIS_STEPS_PER_UNIT;
+
+// Position and modes as far as the firmware will know them when the current line runs
+#define AXES 4  // X, Y, RZ, LZ as in the firmware
+static long pos[AXES];          // Steps
+static bool pos_known[AXES];
+static bool relative = false, mode_known = true;
+static double feed = 0;
+static bool feed_known = false;
+static int laser = 0, laser_wanted = 0;
+static bool laser_known = true;  // Off after reset
+static bool laser_per_move = false; // M604 S1, moves with S are passed on unchanged
+
+static FILE *out;
+static unsigned long out_lines, out_bytes;
+
+static void emit(const char *text)
+{
+  fprintf(out, "%s\n", text);
+  out_lines++;
+  out_bytes += strlen(text) + 1;
+}
+
+// Sends a held back laser change, called before every other line
+static void flush_laser()
+{
+  if(laser_known && laser_wanted == laser)
+    return;
+  char text[16];
+  if(laser_wanted == 0)
+    strcpy(text, "M601");
+  else if(laser_wanted == 255)
+    strcpy(text, "M600");
+  else
+    snprintf(text, sizeof(text), "M600S%d", laser_wanted);
+  emit(text);
+  laser = laser_wanted;
+  laser_known = true;
+}
+
+// Shortest decimal that still rounds to the given step
+static void format_steps(char *buf, long steps, double per_unit)
+{
+  double v = steps / per_unit;
+  for(int decimals = 0; decimals < 7; decimals++) {
+    snprintf(buf, 24, "%.*f", decimals, v);
+    if(fabs(atof(buf) * per_unit - steps) < 0.45) // Margin for the float math of the firmware
+      break;
+  }
+  if(strchr(buf, '.')) {
+    char *e = buf + strlen(buf) - 1;
+    while(*e == '0') *e-- = '\0';
+    if(*e == '.') *e = '\0';
+  }
+  if(strcmp(buf, "-0") == 0) strcpy(buf, "0");
+  // "0.5" -> ".5", "-0.5" -> "-.5"
+  char *digits = (buf[0] == '-') ? buf + 1 : buf;
+  if(digits[0] == '0' && digits[1] == '.')
+    memmove(digits, digits + 1, strlen(digits));
+}
+
+static void format_number(char *buf, double v)
+{
+  snprintf(buf, 24, "%.3f", v);
+  char *e = buf + strlen(buf) - 1;
+  while(*e == '0') *e-- = '\0';
+  if(*e == '.') *e = '\0';
+}
+
+// Words of a line, first occurrence of each letter like the firmware's parse_command()
+struct words {
+  bool seen[26];
+  double value[26];
+  bool other;   // Something that is not a letter followed by a number
+};
+
+static void split(const char *s, words *w)
+{
+  memset(w, 0, sizeof(*w));
+  while(*s) {
+    if(*s == ' ') { s++; continue; }
+    int i = toupper(*s) - 'A';
+    char *end;
+    double v = strtod(s + 1, &end);
+    if(i < 0 || i >= 26 || end == s + 1) {
+      w->other = true;
+      return;
+    }
+    if(!w->seen[i]) {
+      w->seen[i] = true;
+      w->value[i] = v;
+    }
+    s = end;
+  }
+}
+
+#define W(letter) ((letter) - 'A')
+
+// G0/G1 in absolute mode. Returns false if the line has to go out as it is.
+static bool move(int g, const words *w)
+{
+  for(int i = 0; i < 26; i++)
+    if(w->seen[i] && i != W('G') && i != W('X') && i != W('Y') && i != W('Z') &&
+       i != W('R') && i != W('L') && i != W('F') && (i != W('S') || laser_per_move))
+      return false;
+  if(w->seen[W('S')])
+    laser_wanted = (int)fmax(0, fmin(255, w->value[W('S')]));
+
+  long target[AXES];
+  bool given[AXES] = {false, false, false, false};
+  static const char letters[AXES] = {'X', 'Y', 'R', 'L'};
+  for(int a = 0; a < AXES; a++) {
+    target[a] = pos[a];
+    double v;
+    if(w->seen[W(letters[a])])
+      v = w->value[W(letters[a])];
+    else if(a >= 2 && w->seen[W('Z')])
+      v = w->value[W('Z')];
+    else
+      continue;
+    target[a] = lround(v * steps_per_unit[a]);
+    given[a] = !pos_known[a] || target[a] != pos[a];
+  }
+
+  char line[128], num[24];
+  int n = snprintf(line, sizeof(line), "G%d", g);
+  if(given[0]) { format_steps(num, target[0], steps_per_unit[0]); n += snprintf(line + n, sizeof(line) - n, "X%s", num); }
+  if(given[1]) { format_steps(num, target[1], steps_per_unit[1]); n += snprintf(line + n, sizeof(line) - n, "Y%s", num); }
+  if(given[2] && given[3] && target[2] == target[3]) {
+    format_steps(num, target[2], steps_per_unit[2]);
+    n += snprintf(line + n, sizeof(line) - n, "Z%s", num);
+  }
+  else {
+    if(given[2]) { format_steps(num, target[2], steps_per_unit[2]); n += snprintf(line + n, sizeof(line) - n, "R%s", num); }
+    if(given[3]) { format_steps(num, target[3], steps_per_unit[3]); n += snprintf(line + n, sizeof(line) - n, "L%s", num); }
+  }
+  bool any = given[0] || given[1] || given[2] || given[3];
+
+  // F without a move is kept until the next move, the firmware ignores F <= 0
+  if(w->seen[W('F')] && w->value[W('F')] > 0 && (!feed_known || w->value[W('F')] != feed)) {
+    feed = w->value[W('F')];
+    feed_known = false;
+  }
+  if(any && !feed_known && feed > 0) {
+    format_number(num, feed);
+    n += snprintf(line + n, sizeof(line) - n, "F%s", num);
+    feed_known = true;
+  }
+
+  if(any && !laser_per_move && laser_wanted != laser) {
+    n += snprintf(line + n, sizeof(line) - n, "S%d", laser_wanted);
+    laser = laser_wanted;
+  }
+
+  if(any) {
+    flush_laser();
+    emit(line);
+    for(int a = 0; a < AXES; a++) {
+      pos[a] = target[a];
+      if(given[a]) pos_known[a] = true;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if(argc == 4 && strcmp(argv[1], "-u") == 0) {
+    mode_known = false;
+    argc--; argv++;
+  }
+  if(argc != 3) {
+    fprintf(stderr, "usage: %s [-u] input.gcode output.gcode\n", argv[0]);
+    return 1;
+  }
+  FILE *in = fopen(argv[1], "r");
+  if(in == NULL) { perror(argv[1]); return 1; }
+  out = fopen(argv[2], "w");
+  if(out == NULL) { perror(argv[2]); return 1; }
+
+  unsigned long in_lines = 0, in_bytes = 0;
+  char buf[256], folded[sizeof(buf) + 8];
+  while(fgets(buf, sizeof(buf), in)) {
+    in_lines++;
+    in_bytes += strlen(buf);
+    char *c = strchr(buf, ';');
+    if(c) *c = '\0';
+    c = strchr(buf, '*');
+    if(c) *c = '\0';
+    char *s = buf;
+    while(isspace(*s)) s++;
+    if(toupper(*s) == 'N' && isdigit(s[1])) { // Line number
+      s++;
+      while(isdigit(*s)) s++;
+      while(isspace(*s)) s++;
+    }
+    char *e = s + strlen(s);
+    while(e > s && isspace(e[-1])) *--e = '\0';
+    if(*s == '\0') continue;
+
+    words w;
+    split(s, &w);
+    int g = w.seen[W('G')] ? (int)w.value[W('G')] : -1;
+    int m = w.seen[W('M')] ? (int)w.value[W('M')] : -1;
+    if(!w.other && g < 0 && m == 600) {
+      laser_wanted = w.seen[W('S')] ? (int)fmax(0, fmin(255, w.value[W('S')])) : 255;
+      continue;
+    }
+    if(!w.other && g < 0 && m == 601) {
+      laser_wanted = 0;
+      continue;
+    }
+    if(!w.other && g < 0 && m == 604 && w.seen[W('S')])
+      laser_per_move = (w.value[W('S')] != 0);
+    if(!w.other && (g == 0 || g == 1) && mode_known && !relative && move(g, &w))
+      continue;
+    if(!w.other && (g == 0 || g == 1) && !w.seen[W('S')] && !laser_per_move && laser_wanted != laser &&
+       (w.seen[W('X')] || w.seen[W('Y')] || w.seen[W('Z')] || w.seen[W('R')] || w.seen[W('L')])) {
+      // A move passed on as it is (relative mode) still takes the held back change as its S
+      snprintf(folded, sizeof(folded), "%sS%d", s, laser_wanted);
+      s = folded;
+      laser = laser_wanted;
+      laser_known = true;
+    }
+    if((g == 0 || g == 1) && w.seen[W('S')]) { // Passed on with its own S
+      flush_laser();
+      if(!laser_per_move)
+        laser = laser_wanted = (int)fmax(0, fmin(255, w.value[W('S')]));
+    }
+    if(!w.other && (g == 90 || g == 91) && !w.seen[W('M')]) {
+      if(mode_known && relative == (g == 91))
+        continue;
+      relative = (g == 91);
+      mode_known = true;
+    }
+
+    // Passed on as it is, but what it does to the position has to be followed
+    if(g == 28 || g == 2 || g == 3 || ((g == 0 || g == 1) && (relative || !mode_known)) || w.other)
+      for(int a = 0; a < AXES; a++) pos_known[a] = false;
+    if(g >= 0 && g <= 3 && w.seen[W('F')] && w.value[W('F')] > 0) {
+      feed = w.value[W('F')];
+      feed_known = true;
+    }
+    if(g == 92) {
+      static const char letters[AXES] = {'X', 'Y', 'R', 'L'};
+      for(int a = 0; a < AXES; a++) {
+        int i = W(letters[a]);
+        if(!w.seen[i] && a >= 2) i = W('Z');
+        if(w.seen[i]) {
+          pos[a] = lround(w.value[i] * steps_per_unit[a]);
+          pos_known[a] = true;
+        }
+      }
+    }
+    flush_laser();
+    emit(s);
+  }
+  flush_laser();
+  fclose(in);
+  fclose(out);
+
+  fprintf(stderr, "%lu lines, %lu bytes -> %lu lines, %lu bytes (%.1f%% of the lines, %.1f%% of the bytes)\n",
+    in_lines, in_bytes, out_lines, out_bytes,
+    in_lines ? 100.0 * out_lines / in_lines : 0.0, in_bytes ? 100.0 * out_bytes / in_bytes : 0.0);
+  return 0;
+}
@@ -0,0 +1,65 @@
+/*
+  gcodeopttest - runs gcodeopt on short inputs and compares its output line by line
+    gcodeopttest
+
+  Each case is a move sequence where dropping or shortening a line would change what the
+  machine does. The numbers are 0 or whole steps, so the cases do not depend on the steps per
+  unit of Configuration.h. Built and run by "make check" like fwtest, after gcodeopt.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+static int checks, failures;
+
+static void check_case(const char *what, const char *input, const char *expected)
+{
+  checks++;
+  char in_name[] = "/tmp/gcodeoptinXXXXXX", out_name[] = "/tmp/gcodeoptoutXXXXXX";
+  int in_fd = mkstemp(in_name), out_fd = mkstemp(out_name);
+  if(in_fd < 0 || out_fd < 0) { perror("mkstemp"); exit(1); }
+  if(write(in_fd, input, strlen(input)) != (ssize_t)strlen(input)) { perror(in_name); exit(1); }
+  close(in_fd);
+  close(out_fd);
+
+  std::string command = std::string("./gcodeopt ") + in_name + " " + out_name + " 2>/dev/null";
+  std::string got;
+  if(system(command.c_str()) == 0) {
+    FILE *out = fopen(out_name, "r");
+    char buf[256];
+    while(out && fgets(buf, sizeof(buf), out))
+      got += buf;
+    if(out) fclose(out);
+  }
+  unlink(in_name);
+  unlink(out_name);
+  if(got != expected) {
+    failures++;
+    fprintf(stderr, "FAILED: %s\n--- expected\n%s--- got\n%s", what, expected, got.c_str());
+  }
+}
+
+int main()
+{
+  check_case("the position after an arc is not the one before it",
+    "G1 X0 Y0 F600\nG2 X10 Y0 I5 J0\nG1 X0 Y0\nG1 X0 Y0\n",
+    "G1X0Y0F600\nG2 X10 Y0 I5 J0\nG1X0Y0\n");
+  check_case("the F of an arc is the feedrate after it",
+    "G1 X0 Y0 F600\nG3 X0 Y10 I0 J5 F1200\nG1 X0 Y0 F1200\n",
+    "G1X0Y0F600\nG3 X0 Y10 I0 J5 F1200\nG1X0Y0\n");
+  check_case("the position after G28 is not the one before it",
+    "G1 X0 Y0 F600\nG28\nG1 X0 Y0\n",
+    "G1X0Y0F600\nG28\nG1X0Y0\n");
+  check_case("a relative move leaves the position unknown",
+    "G1 X0 Y0 F600\nG91\nG1 X1\nG90\nG1 X0 Y0\n",
+    "G1X0Y0F600\nG91\nG1 X1\nG90\nG1X0Y0\n");
+  check_case("moves to where the machine is are dropped",
+    "G1 Z1 F60\nG1 Z1\nG1 X0 Y0\nG1 X0 Y0 Z1\n",
+    "G1Z1F60\nG1X0Y0\n");
+
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,25 @@
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Just enough of the Arduino 0022 Print for SdFile and the serial port
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual void write(uint8_t c) = 0;
+  virtual void write(const char *s) { while(*s) write((uint8_t)*s++); }
+  virtual void write(const uint8_t *buf, size_t n) { while(n--) write(*buf++); }
+  void print(const char *s) { write(s); }
+  void print(char c) { write((uint8_t)c); }
+  void print(long n);
+  void print(unsigned long n);
+  void print(int n) { print((long)n); }
+  void print(unsigned int n) { print((unsigned long)n); }
+  void print(unsigned char n) { print((unsigned long)n); }
+  void print(double d, int digits = 2);
+  void println() { write('\r'); write('\n'); }
+  template<class T> void println(T x) { print(x); println(); }
+};
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+// Marlin.ino still includes the Arduino SPI library, the firmware drives the SPI through spibus.cpp
+class SPIClass {
+ public:
+  void begin() {}
+};
+extern SPIClass SPI;
+#endif
@@ -0,0 +1,54 @@
+#ifndef HOST_WPROGRAM_H
+#define HOST_WPROGRAM_H
+// The parts of the Arduino core the firmware sources use, see arduino.cpp
+#include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <avr/io.h>
+#include "Print.h"
+#include "WString.h"
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+// Compared in the common type, like the macros of the Arduino core
+template<class A, class B> inline A min(A a, B b) { typedef __typeof__(a + b) C; return (C)a < (C)b ? a : (A)b; }
+template<class A, class B> inline A max(A a, B b) { typedef __typeof__(a + b) C; return (C)a > (C)b ? a : (A)b; }
+inline double square(double x) { return x * x; } // avr-libc math.h
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+// Serial input comes from host_serial_input(), the output is collected for the host program
+class HostSerial : public Print {
+ public:
+  void begin(long) {}
+  void write(uint8_t c);
+  using Print::write;
+  int available();
+  int read();
+  void flush();   // Drops the input like the Arduino 0022 core
+};
+extern HostSerial Serial;
+
+void host_serial_input(const char *text);
+void host_serial_input(const uint8_t *data, int count); // Binary, may hold 0
+void host_serial_reply(const char *trigger, const char *text); // Input once the output ends with trigger
+const char *host_serial_output();   // Everything written since host_serial_clear()
+void host_serial_clear();
+extern bool host_serial_echo;       // Also copy the output to stdout
+extern unsigned long host_serial_bytes, host_serial_lines;
+
+#endif
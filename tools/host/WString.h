@@ -0,0 +1,15 @@
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+#include <string.h>
+
+// Just enough of the Arduino String for MarlinSerial::print(const String &)
+class String {
+ public:
+  String(const char *s = "") : s(s) {}
+  unsigned int length() const { return strlen(s); }
+  char operator[](unsigned int i) const { return s[i]; }
+ private:
+  const char *s;
+};
+
+#endif
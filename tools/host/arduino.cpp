@@ -0,0 +1,135 @@
+// The parts of the Arduino core the firmware sources use, on the host. See WProgram.h.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <string>
+#include <deque>
+
+#include "WProgram.h"
+#include "avr/eeprom.h"
+#include "SPI.h"
+
+volatile uint8_t host_io[64];
+HostSerial Serial;
+SPIClass SPI;
+host_spdr host_spi_data;
+static uint8_t spi_data;
+
+host_spdr &host_spdr::operator=(uint8_t c)
+{
+  spi_data = c;
+  SPSR |= _BV(SPIF);
+  return *this;
+}
+
+host_spdr::operator uint8_t() const
+{
+  return spi_data;
+}
+bool host_serial_echo = false;
+unsigned long host_serial_bytes, host_serial_lines;
+
+static std::deque<uint8_t> serial_in;
+static std::string serial_out;
+static std::string reply_trigger, reply_text;
+
+unsigned long millis()
+{
+  return micros() / 1000;
+}
+
+unsigned long micros()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000UL + t.tv_nsec / 1000;
+}
+
+void delay(unsigned long ms) { usleep(ms * 1000); }
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return LOW; }
+void analogWrite(uint8_t, int) {}
+
+// freeMemory() of Marlin.ino
+extern "C" {
+  unsigned int __bss_end;
+  unsigned int __heap_start;
+  void *__brkval;
+}
+
+static uint8_t eeprom[4096];
+
+uint8_t eeprom_read_byte(const uint8_t *p) { return eeprom[(uintptr_t)p % sizeof(eeprom)]; }
+void eeprom_write_byte(uint8_t *p, uint8_t value) { eeprom[(uintptr_t)p % sizeof(eeprom)] = value; }
+
+void HostSerial::write(uint8_t c)
+{
+  host_serial_bytes++;
+  if(c == '\n')
+    host_serial_lines++;
+  serial_out += (char)c;
+  if(host_serial_echo)
+    putchar(c);
+  if(!reply_trigger.empty() && serial_out.size() >= reply_trigger.size() &&
+     serial_out.compare(serial_out.size() - reply_trigger.size(), std::string::npos, reply_trigger) == 0) {
+    reply_trigger.clear();
+    host_serial_input(reply_text.c_str());
+  }
+}
+
+int HostSerial::available() { return serial_in.size(); }
+
+int HostSerial::read()
+{
+  if(serial_in.empty())
+    return -1;
+  uint8_t c = serial_in.front();
+  serial_in.pop_front();
+  return c;
+}
+
+void HostSerial::flush() { serial_in.clear(); }
+
+void host_serial_input(const char *text)
+{
+  while(*text)
+    serial_in.push_back(*text++);
+}
+
+void host_serial_input(const uint8_t *data, int count)
+{
+  serial_in.insert(serial_in.end(), data, data + count);
+}
+
+void host_serial_reply(const char *trigger, const char *text)
+{
+  reply_trigger = trigger;
+  reply_text = text;
+}
+
+const char *host_serial_output() { return serial_out.c_str(); }
+void host_serial_clear() { serial_out.clear(); }
+
+void Print::print(long n)
+{
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%ld", n);
+  write(buf);
+}
+
+void Print::print(unsigned long n)
+{
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%lu", n);
+  write(buf);
+}
+
+void Print::print(double d, int digits)
+{
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%.*f", digits, d);
+  write(buf);
+}
@@ -0,0 +1,7 @@
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+#include <stdint.h>
+// 4 KB like the AT90USB1286, kept in memory, see ../sdimage.cpp
+uint8_t eeprom_read_byte(const uint8_t *p);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+#endif
@@ -0,0 +1,8 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+// The I bit of SREG is kept like on the AVR, ../uart.cpp only interrupts while it is set
+#define cli() (SREG &= ~0x80)
+#define sei() (SREG |= 0x80)
+#define ISR(vector) extern "C" void vector()
+#define SIGNAL(vector) extern "C" void vector()
+#endif
@@ -0,0 +1,144 @@
+// Host build of the SD code (see ../sdimage.cpp): I/O registers are plain variables
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+#include <stdint.h>
+
+extern volatile uint8_t host_io[64];
+#define DDRA  host_io[0]
+#define PINA  host_io[1]
+#define PORTA host_io[2]
+#define DDRB  host_io[3]
+#define PINB  host_io[4]
+#define PORTB host_io[5]
+#define DDRC  host_io[6]
+#define PINC  host_io[7]
+#define PORTC host_io[8]
+#define DDRD  host_io[9]
+#define PIND  host_io[10]
+#define PORTD host_io[11]
+#define DDRE  host_io[12]
+#define PINE  host_io[13]
+#define PORTE host_io[14]
+#define DDRF  host_io[15]
+#define PINF  host_io[16]
+#define PORTF host_io[17]
+#define SREG  host_io[18]
+#define MCUSR host_io[19]
+
+// Bit numbers, for fastio.h
+#define PINA0 0
+#define PINA1 1
+#define PINA2 2
+#define PINA3 3
+#define PINA4 4
+#define PINA5 5
+#define PINA6 6
+#define PINA7 7
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINB6 6
+#define PINB7 7
+#define PINC0 0
+#define PINC1 1
+#define PINC2 2
+#define PINC3 3
+#define PINC4 4
+#define PINC5 5
+#define PINC6 6
+#define PINC7 7
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+#define PINE0 0
+#define PINE1 1
+#define PINE2 2
+#define PINE3 3
+#define PINE4 4
+#define PINE5 5
+#define PINE6 6
+#define PINE7 7
+#define PINF0 0
+#define PINF1 1
+#define PINF2 2
+#define PINF3 3
+#define PINF4 4
+#define PINF5 5
+#define PINF6 6
+#define PINF7 7
+
+#define SREG_I 7
+
+#ifdef __AVR_ATmega2560__
+// USART0 of the MarlinSerial build, modelled on a pty by ../uart.cpp
+struct host_udr {
+  host_udr &operator=(uint8_t c);   // Starts sending c
+  operator uint8_t() const;         // The byte received last
+};
+extern host_udr host_udr0;
+#define UDR0    host_udr0
+#define UCSR0A  host_io[20]
+#define UCSR0B  host_io[21]
+#define UBRR0H  host_io[22]
+#define UBRR0L  host_io[23]
+#define U2X0    1
+#define DOR0    3
+#define UDRE0   5
+#define TXEN0   3
+#define RXEN0   4
+#define UDRIE0  5
+#define RXCIE0  7
+#define USART0_RX_vect   host_usart0_rx_vect
+#define USART0_UDRE_vect host_usart0_udre_vect
+#endif
+
+// Timer 1 of the stepper interrupt, modelled by ../timer1.cpp
+struct host_tcnt1 {
+  host_tcnt1 &operator=(uint16_t count);
+  operator uint16_t() const;        // Runs on while host_timer1_interrupt() is in the ISR
+};
+extern host_tcnt1 host_timer1_count;
+extern volatile uint16_t host_ocr1a;
+#define TCNT1   host_timer1_count
+#define OCR1A   host_ocr1a
+#define TCCR1A  host_io[24]
+#define TCCR1B  host_io[25]
+#define TIMSK1  host_io[26]
+#define TIFR1   host_io[27]
+#define WGM10   0
+#define WGM11   1
+#define COM1B0  4
+#define COM1A0  6
+#define CS10    0
+#define WGM12   3
+#define WGM13   4
+#define OCIE1A  1
+#define OCF1A   1
+#define TIMER1_COMPA_vect host_timer1_compa_vect
+
+// The SPI of spibus.cpp: a byte written to SPDR is sent at once (see ../arduino.cpp)
+struct host_spdr {
+  host_spdr &operator=(uint8_t c);  // Sets SPIF
+  operator uint8_t() const;
+};
+extern host_spdr host_spi_data;
+#define SPDR    host_spi_data
+#define SPCR    host_io[28]
+#define SPSR    host_io[29]
+#define SPI2X   0
+#define MSTR    4
+#define SPE     6
+#define SPIF    7
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_BYTE(sfr) (sfr)
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+#include <string.h>
+#include <stdint.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_byte_near(p) pgm_read_byte(p)
+// Reads the type pointed to: a word on the AVR is also a pointer (Marlin.ino's command table)
+template<class T> inline T host_pgm_read(const T *p) { return *p; }
+#define pgm_read_word(p) host_pgm_read(p)
+#define pgm_read_word_near(p) pgm_read_word(p)
+#define pgm_read_float_near(p) (*(const float *)(p))
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strlen_P strlen
+#define memcpy_P memcpy
+typedef char prog_char;
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+#define wdt_reset()
+#endif
@@ -0,0 +1,67 @@
+// Stand-ins for planner.cpp and stepper.cpp, see motion.h
+
+#include "../../Marlin/Marlin.h"
+#include "../../Marlin/planner.h"
+#include "../../Marlin/stepper.h"
+#include "motion.h"
+
+std::vector<host_move> host_moves;
+
+unsigned long minsegmenttime;
+float max_feedrate[4];
+float axis_steps_per_unit[4];
+unsigned long max_acceleration_units_per_sq_second[4];
+float minimumfeedrate;
+float acceleration;
+float retract_acceleration;
+float max_xy_jerk;
+float max_z_jerk;
+float max_e_jerk;
+float mintravelfeedrate;
+unsigned long axis_steps_per_sqr_second[NUM_AXIS];
+block_t block_buffer[BLOCK_BUFFER_SIZE];
+volatile unsigned char block_buffer_head;
+volatile unsigned char block_buffer_tail;
+block_t *current_block;
+
+void plan_init() {}
+
+void plan_buffer_line(const float &x, const float &y, const float &z, const float &e, float feed_rate, const uint8_t &)
+{
+  host_move m = { x, y, z, e, feed_rate, LaserPower };
+  host_moves.push_back(m);
+}
+
+static float plan_position[NUM_AXIS];
+
+void plan_set_position(const float &x, const float &y, const float &z, const float &e)
+{
+  plan_position[X_AXIS] = x; plan_position[Y_AXIS] = y;
+  plan_position[RZ_AXIS] = z; plan_position[LZ_AXIS] = e;
+}
+
+uint8_t movesplanned() { return 0; }
+void check_axes_activity() {}
+#if LASER_PIN > -1
+void plan_set_idle_laser_power() {}
+#endif
+
+void st_init() {}
+void st_synchronize() {}
+long st_get_position(uint8_t axis) { return lround(plan_position[axis] * axis_steps_per_unit[axis]); }
+void move_galvos(unsigned long, unsigned long) {}
+void set_galvo_pos(unsigned long, unsigned long) {}
+void checkHitEndstops() {}
+void endstops_hit_on_purpose() {}
+void enable_endstops(bool) {}
+void finishAndDisableSteppers() {}
+void quickStop() {}
+#if LASER_PIN > -1
+void st_set_laser_power(unsigned char) {}
+#endif
+#ifdef STEPPER_ISR_PROFILE
+void st_profile_report() {}
+void st_profile_reset() {}
+#endif
+
+void spi_bus_init() {}
@@ -0,0 +1,16 @@
+#ifndef HOST_MOTION_H
+#define HOST_MOTION_H
+
+// Planner and stepper for host builds of Marlin.ino (see motion.cpp): plan_buffer_line()
+// records the moves instead of queueing them, they count as done right away.
+
+#include <vector>
+
+struct host_move {
+  float x, y, rz, lz;
+  float feed_rate;          // mm/s as handed to plan_buffer_line()
+  unsigned char laser;      // LaserPower when the move was planned
+};
+extern std::vector<host_move> host_moves;
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef HOST_PINS_ARDUINO_H
+#define HOST_PINS_ARDUINO_H
+// Nothing of it is used, the pins come from ../../Marlin/pins.h and fastio.h
+#endif
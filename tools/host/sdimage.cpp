@@ -0,0 +1,210 @@
+// Host side of the SD code: Sd2Card on a disk image, see sdimage.h.
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../Marlin/Marlin.h"
+#include "../../Marlin/Sd2Card.h"
+#include "sdimage.h"
+
+sd_image_stats sd_stats;
+
+static uint8_t *image;
+static uint32_t image_blocks;
+static unsigned long command_us, block_us;
+
+//------------------------------------------------------------------------------
+// Image
+bool sd_image_open(const char *path)
+{
+  sd_image_close();
+  int fd = open(path, O_RDWR);
+  if(fd < 0) { perror(path); return false; }
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.st_size < 512) {
+    fprintf(stderr, "%s: not a disk image\n", path);
+    close(fd);
+    return false;
+  }
+  void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == MAP_FAILED) { perror(path); return false; }
+  image = (uint8_t *)p;
+  image_blocks = st.st_size / 512;
+  return true;
+}
+
+// FAT16 "superfloppy" without a partition table, 4 sectors per cluster, 512 root entries
+bool sd_image_format(const char *path, unsigned long megabytes)
+{
+  uint32_t sectors = megabytes * 2048;
+  uint16_t fat_sectors = ((sectors / 4) * 2 + 511) / 512;
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) { perror(path); return false; }
+  if(ftruncate(fd, (off_t)sectors * 512) < 0) { perror(path); close(fd); return false; }
+
+  uint8_t boot[512];
+  memset(boot, 0, sizeof(boot));
+  memcpy(boot, "\xEB\x3C\x90MSWIN4.1", 11);
+  boot[11] = 0; boot[12] = 2;           // Bytes per sector
+  boot[13] = 4;                         // Sectors per cluster
+  boot[14] = 1;                         // Reserved sectors
+  boot[16] = 2;                         // FATs
+  boot[17] = 512 & 0xFF; boot[18] = 512 >> 8; // Root entries
+  boot[21] = 0xF8;
+  boot[22] = fat_sectors & 0xFF; boot[23] = fat_sectors >> 8;
+  boot[24] = 32; boot[26] = 64;
+  for(int i = 0; i < 4; i++) boot[32 + i] = (sectors >> (8 * i)) & 0xFF;
+  boot[36] = 0x80; boot[38] = 0x29;
+  memcpy(boot + 43, "NO NAME    FAT16   ", 19);
+  boot[510] = 0x55; boot[511] = 0xAA;
+  bool ok = pwrite(fd, boot, 512, 0) == 512;
+  static const uint8_t fat_start[4] = {0xF8, 0xFF, 0xFF, 0xFF};
+  for(int f = 0; f < 2; f++)
+    ok = ok && pwrite(fd, fat_start, 4, (off_t)(1 + f * fat_sectors) * 512) == 4;
+  close(fd);
+  if(!ok) perror(path);
+  return ok;
+}
+
+void sd_image_close()
+{
+  if(image) {
+    munmap(image, (size_t)image_blocks * 512);
+    image = NULL;
+  }
+}
+
+void sd_image_timing(unsigned long command, unsigned long block)
+{
+  command_us = command;
+  block_us = block;
+}
+
+void sd_image_reset_stats()
+{
+  memset(&sd_stats, 0, sizeof(sd_stats));
+}
+
+static void command()
+{
+  sd_stats.commands++;
+  sd_stats.card_us += command_us;
+}
+
+//------------------------------------------------------------------------------
+// Sd2Card, the functions the SD code links against
+bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin)
+{
+  errorCode_ = 0;
+  inStream_ = false;
+  chipSelectPin_ = chipSelectPin;
+  spiRate_ = sckRateID;
+  type(SD_CARD_TYPE_SDHC);
+  if(!image) {
+    error(SD_CARD_ERROR_CMD0);
+    return false;
+  }
+  return true;
+}
+
+uint32_t Sd2Card::cardSize() { return image_blocks; }
+
+bool Sd2Card::readBlock(uint32_t block, uint8_t *dst)
+{
+  if(inStream_)
+    readStop();
+  command();
+  sd_stats.single_reads++;
+  if(block >= image_blocks) {
+    error(SD_CARD_ERROR_CMD17);
+    return false;
+  }
+  memcpy(dst, image + (size_t)block * 512, 512);
+  sd_stats.blocks_read++;
+  sd_stats.card_us += block_us;
+  return true;
+}
+
+bool Sd2Card::readStream(uint32_t blockNumber, uint8_t *dst)
+{
+  if(!inStream_ || blockNumber != streamBlock_) {
+    if(inStream_)
+      readStop();
+    command();
+    sd_stats.stream_starts++;
+    inStream_ = true;
+  }
+  if(blockNumber >= image_blocks) {
+    error(SD_CARD_ERROR_READ);
+    readStop();
+    return false;
+  }
+  memcpy(dst, image + (size_t)blockNumber * 512, 512);
+  sd_stats.blocks_read++;
+  sd_stats.card_us += block_us;
+  streamBlock_ = blockNumber + 1;
+  return true;
+}
+
+bool Sd2Card::readStop()
+{
+  inStream_ = false;
+  command();
+  sd_stats.stream_stops++;
+  return true;
+}
+
+bool Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t *src)
+{
+  if(inStream_)
+    readStop();
+  command(); // CMD24
+  command(); // CMD13 after programming
+  if(blockNumber >= image_blocks) {
+    error(SD_CARD_ERROR_CMD24);
+    return false;
+  }
+  memcpy(image + (size_t)blockNumber * 512, src, 512);
+  sd_stats.blocks_written++;
+  sd_stats.card_us += block_us;
+  return true;
+}
+
+// Multiple block write: writeStart() sets the block, writeData() goes on from there
+static uint32_t write_block;
+
+bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t)
+{
+  if(inStream_)
+    readStop();
+  command(); // ACMD23
+  command(); // CMD25
+  write_block = blockNumber;
+  sd_stats.write_starts++;
+  return true;
+}
+
+bool Sd2Card::writeData(const uint8_t *src)
+{
+  if(write_block >= image_blocks) {
+    error(SD_CARD_ERROR_WRITE_MULTIPLE);
+    return false;
+  }
+  memcpy(image + (size_t)write_block * 512, src, 512);
+  write_block++;
+  sd_stats.blocks_written++;
+  sd_stats.card_us += block_us;
+  return true;
+}
+
+bool Sd2Card::writeStop()
+{
+  command(); // Stop token
+  sd_stats.write_stops++;
+  return true;
+}
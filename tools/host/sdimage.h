@@ -0,0 +1,29 @@
+#ifndef SDIMAGE_H
+#define SDIMAGE_H
+
+// Sd2Card on a FAT16/FAT32 disk image, for building the SD code of the firmware (SdVolume,
+// SdBaseFile, SdFile, CardReader) on the host. Sd2Card::init() maps the image given here, the
+// reads and writes of the real code then go to that file.
+//
+// The card itself takes no time here. What a card would take is added up instead: every
+// command (CMD17, CMD18, CMD12, CMD24, CMD25, ACMD23, stop token) costs command_us and every
+// block moved costs block_us.
+
+#include <stdint.h>
+
+bool sd_image_open(const char *path);
+bool sd_image_format(const char *path, unsigned long megabytes); // Empty FAT16 image, 16 MB or more
+void sd_image_close();
+void sd_image_timing(unsigned long command_us, unsigned long block_us);
+
+struct sd_image_stats {
+  unsigned long commands;   // All commands, including the ones below
+  unsigned long single_reads, stream_starts, stream_stops;
+  unsigned long write_starts, write_stops; // Multiple block writes (CMD25) and their stop tokens
+  unsigned long blocks_read, blocks_written;
+  double card_us;           // Time a card with the configured latencies would have taken
+};
+extern sd_image_stats sd_stats;
+void sd_image_reset_stats();
+
+#endif
@@ -0,0 +1,48 @@
+// Timer 1 for the stepper ISR, see timer1.h
+#include <avr/io.h>
+
+#include "timer1.h"
+
+extern "C" void host_timer1_compa_vect();
+
+host_tcnt1 host_timer1_count;
+volatile uint16_t host_ocr1a;
+unsigned long host_timer1_wraps;
+
+static uint16_t count;
+static uint16_t isr_latency, isr_duration;
+static int isr_reads = -1;  // Reads of TCNT1 in the running ISR, -1 outside
+
+host_tcnt1 &host_tcnt1::operator=(uint16_t value)
+{
+  count = value;
+  return *this;
+}
+
+host_tcnt1::operator uint16_t() const
+{
+  if(isr_reads < 0)
+    return count;
+  if(isr_reads++ == 0)
+    return isr_latency;
+  // It started from 0 at the compare match, the next match at OCR1A sets OCF1A and the tick
+  // after that it starts over
+  unsigned long ticks = (unsigned long)isr_latency + isr_duration;
+  if(ticks >= OCR1A) {
+    if(!(TIFR1 & _BV(OCF1A)))
+      host_timer1_wraps++;
+    TIFR1 |= _BV(OCF1A);
+    return ticks % ((unsigned long)OCR1A + 1);
+  }
+  return ticks;
+}
+
+void host_timer1_interrupt(uint16_t latency, uint16_t duration)
+{
+  TIFR1 &= ~_BV(OCF1A);     // Cleared by entering the ISR
+  isr_latency = latency;
+  isr_duration = duration;
+  isr_reads = 0;
+  host_timer1_compa_vect();
+  isr_reads = -1;
+}
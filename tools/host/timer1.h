@@ -0,0 +1,14 @@
+#ifndef TIMER1_H
+#define TIMER1_H
+#include <stdint.h>
+
+// Timer 1 in CTC mode for building stepper.cpp on the host. Nothing counts by itself: the
+// host program calls the stepper ISR through host_timer1_interrupt() as if it started latency
+// ticks after the compare match and took duration ticks. Inside it TCNT1 reads latency, then
+// latency + duration, wrapped at OCR1A with OCF1A set in TIFR1 like the counter would. A new
+// OCR1A the ISR sets counts as set before the counter got there.
+
+void host_timer1_interrupt(uint16_t latency, uint16_t duration);
+extern unsigned long host_timer1_wraps;   // Interrupts that ran past OCR1A
+
+#endif
@@ -0,0 +1,94 @@
+// USART0 on a pty, see uart.h
+#define _XOPEN_SOURCE 600
+#include <avr/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/time.h>
+
+#include "uart.h"
+
+extern "C" void host_usart0_rx_vect();
+extern "C" void host_usart0_udre_vect();
+
+host_udr host_udr0;
+static int master_fd = -1, slave_fd = -1;
+static unsigned rx_per_tick;
+static volatile uint8_t rx_byte;
+
+host_udr &host_udr::operator=(uint8_t c)
+{
+  if(write(slave_fd, &c, 1) != 1) {} // The pty buffers far more than a test sends unread
+  UCSR0A &= ~_BV(UDRE0);              // Until the byte is out, at the next tick
+  return *this;
+}
+
+host_udr::operator uint8_t() const
+{
+  return rx_byte;
+}
+
+static void tick(int)
+{
+  UCSR0A |= _BV(UDRE0); // The byte in UDR0 is out, with or without interrupts
+  if(!(SREG & _BV(SREG_I)))
+    return; // Interrupts off, they are level triggered and come at a later tick
+  for(unsigned i = 0; i < rx_per_tick && (UCSR0B & _BV(RXCIE0)); i++) {
+    uint8_t c;
+    if(read(slave_fd, &c, 1) != 1)
+      break;
+    rx_byte = c;
+    host_usart0_rx_vect();
+  }
+  if((UCSR0B & _BV(UDRIE0)) && (UCSR0A & _BV(UDRE0)))
+    host_usart0_udre_vect();
+}
+
+int host_uart_open(unsigned tick_us, unsigned bytes_per_tick)
+{
+  master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0) {
+    perror("posix_openpt");
+    return -1;
+  }
+  slave_fd = open(ptsname(master_fd), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if(slave_fd < 0) {
+    perror(ptsname(master_fd));
+    return -1;
+  }
+  struct termios t;
+  tcgetattr(slave_fd, &t);
+  cfmakeraw(&t);
+  tcsetattr(slave_fd, TCSANOW, &t);
+  tcgetattr(master_fd, &t);
+  cfmakeraw(&t);
+  tcsetattr(master_fd, TCSANOW, &t);
+
+  rx_per_tick = bytes_per_tick;
+  UCSR0A = _BV(UDRE0);
+  SREG |= _BV(SREG_I);
+  struct sigaction sa;
+  sa.sa_handler = tick;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &sa, NULL);
+  struct itimerval timer = { { 0, (long)tick_us }, { 0, (long)tick_us } };
+  setitimer(ITIMER_REAL, &timer, NULL);
+  return master_fd;
+}
+
+const char *host_uart_name()
+{
+  return ptsname(master_fd);
+}
+
+void host_uart_close()
+{
+  struct itimerval off = { { 0, 0 }, { 0, 0 } };
+  setitimer(ITIMER_REAL, &off, NULL);
+  close(slave_fd);
+  close(master_fd);
+}
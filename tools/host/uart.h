@@ -0,0 +1,16 @@
+#ifndef UART_H
+#define UART_H
+
+// USART0 of the ATmega2560 on a pty, for building MarlinSerial on the host. The registers of
+// avr/io.h are plain variables except UDR0. A SIGALRM tick stands in for the interrupts: on
+// every tick, and only while the I bit of SREG is set like on the AVR, it
+// - hands up to bytes_per_tick bytes from the pty to USART0_RX_vect through UDR0
+// - lets one byte written to UDR0 finish, so UDRE0 is set again and USART0_UDRE_vect runs
+// A byte per tick limits the transmitter to a baud rate, so the TX ring of MarlinSerial fills
+// up like on the board. The other end of the pty is the host program's serial port.
+
+int host_uart_open(unsigned tick_us, unsigned bytes_per_tick); // File descriptor of that end
+const char *host_uart_name();   // Path of that end, for programs like streambench
+void host_uart_close();
+
+#endif
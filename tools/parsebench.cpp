@@ -0,0 +1,121 @@
+/*
+  parsebench - times the G-code parsing of the firmware for G0/G1 lines on the host
+    parsebench [-n rounds] [file.gcode]
+
+  The G0/G1 lines of the file (or 10000 generated hatch moves like "G1 X12.345 Y-67.89 F1500
+  S200") are parsed over and over by the code of Marlin.ino, compiled in as it is:
+  - strtod:   strchr() and strtod() for each of G X Y Z R L F S, the way code_seen() and
+              code_value() worked before parse_command()
+  - tokenize: parse_command(), the single pass over the line
+  - G1:       parse_command() and get_coordinates() with the S word, everything a move line
+              costs before the planner
+  The times are for the host CPU; the ratios are what carries over to the AVR, where strtod()
+  is much slower still. -n sets the number of passes over the lines (default 100).
+*/
+
+#include "../Marlin/Marlin.ino"
+
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+static std::vector<std::string> lines;
+
+static double now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void report(const char *what, double seconds, unsigned long count, float sum)
+{
+  printf("%-9s %8.1f ns/line  %10.0f lines/s  (checksum %g)\n", what, seconds * 1e9 / count,
+    count / seconds, sum);
+}
+
+// The words a move line is asked for, as code_seen()/code_value() did with strchr()/strtod()
+static float parse_strtod(const char *line)
+{
+  static const char letters[] = "GXYZRLFS";
+  float sum = 0;
+  for(const char *l = letters; *l; l++) {
+    const char *p = strchr(line, *l);
+    if(p != NULL)
+      sum += strtod(p + 1, NULL);
+  }
+  return sum;
+}
+
+int main(int argc, char **argv)
+{
+  int rounds = 100, opt;
+  while((opt = getopt(argc, argv, "n:")) != -1) {
+    if(opt == 'n')
+      rounds = atoi(optarg);
+    else {
+      fprintf(stderr, "usage: %s [-n rounds] [file.gcode]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(optind < argc) {
+    FILE *in = fopen(argv[optind], "r");
+    if(in == NULL) { perror(argv[optind]); return 1; }
+    char buf[256];
+    while(fgets(buf, sizeof(buf), in)) {
+      char *c = strpbrk(buf, ";\r\n");
+      if(c) *c = '\0';
+      if(buf[0] == 'G' && (buf[1] == '0' || buf[1] == '1') && !(buf[2] >= '0' && buf[2] <= '9'))
+        lines.push_back(buf);
+    }
+    fclose(in);
+  }
+  else {
+    srand(1);
+    for(int i = 0; i < 10000; i++) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "G1 X%.3f Y%.3f F%d S%d", (rand() % 200000 - 100000) * 0.001,
+        (rand() % 200000 - 100000) * 0.001, (i & 1) ? 1500 : 6000, (i & 1) ? 200 : 0);
+      lines.push_back(buf);
+    }
+  }
+  if(lines.empty()) {
+    fprintf(stderr, "no G0/G1 lines\n");
+    return 1;
+  }
+  std::vector<std::vector<char> > text(lines.size());
+  for(size_t i = 0; i < lines.size(); i++)
+    text[i].assign(lines[i].c_str(), lines[i].c_str() + lines[i].size() + 1);
+  unsigned long count = (unsigned long)lines.size() * rounds;
+  printf("%lu lines, %d rounds\n", (unsigned long)lines.size(), rounds);
+
+  float sum = 0;
+  double started = now();
+  for(int r = 0; r < rounds; r++)
+    for(size_t i = 0; i < text.size(); i++)
+      sum += parse_strtod(&text[i][0]);
+  report("strtod", now() - started, count, sum);
+
+  sum = 0;
+  started = now();
+  for(int r = 0; r < rounds; r++)
+    for(size_t i = 0; i < text.size(); i++) {
+      parse_command(&text[i][0]);
+      sum += parsed.value['X' - 'A'];
+    }
+  report("tokenize", now() - started, count, sum);
+
+  sum = 0;
+  started = now();
+  for(int r = 0; r < rounds; r++)
+    for(size_t i = 0; i < text.size(); i++) {
+      parse_command(&text[i][0]);
+      get_coordinates();
+      if(code_seen('S'))
+        sum += code_value();
+      sum += destination[X_AXIS];
+    }
+  report("G1", now() - started, count, sum);
+  return 0;
+}
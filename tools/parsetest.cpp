@@ -0,0 +1,142 @@
+/*
+  parsetest - compares the firmware's number parsing with the C library
+    parsetest
+
+  parse_float() and parse_long() of Marlin.ino are run on every number of the grids slicers
+  write (0.1, 0.01, 0.001 and 0.0001 mm steps over the bed and beyond, in the spellings "+1.5",
+  ".5", "-0.50", "2.") and on floats printed with 9 significant digits and at most the 9
+  decimals parse_float() reads. parse_float() may be one unit in the last place off strtof(),
+  two for more than 7 significant digits, where the mantissa no longer converts to float
+  exactly. parse_long() has to match strtol() exactly. Both have to stop at the same
+  character. Built and run by "make check" like fwtest.
+*/
+
+#include "../Marlin/Marlin.ino"
+
+#include <math.h>
+#include <limits.h>
+
+static unsigned long cases, failures;
+
+// Units in the last place between two floats of the same sign
+static long ulps(float a, float b)
+{
+  if(a == b) return 0;
+  if((a < 0) != (b < 0)) return LONG_MAX;
+  int32_t ia, ib;
+  memcpy(&ia, &a, sizeof(ia));
+  memcpy(&ib, &b, sizeof(ib));
+  return labs((long)ia - (long)ib);
+}
+
+static void check_float(const char *text, long allowed)
+{
+  cases++;
+  char *end, *expected_end;
+  float got = parse_float(text, &end);
+  float expected = strtof(text, &expected_end);
+  if(end != expected_end || ulps(got, expected) > allowed) {
+    if(failures++ < 20)
+      fprintf(stderr, "parse_float(\"%s\") = %.9g, end +%d, strtof %.9g, end +%d\n",
+        text, got, (int)(end - text), expected, (int)(expected_end - text));
+  }
+}
+
+static void check_long(const char *text)
+{
+  cases++;
+  char *expected_end;
+  long expected = strtol(text, &expected_end, 10);
+  long got = parse_long(text);
+  if(got != expected) {
+    if(failures++ < 20)
+      fprintf(stderr, "parse_long(\"%s\") = %ld, strtol %ld\n", text, got, expected);
+  }
+}
+
+// Significant digits of a number without exponent, to pick the tolerance
+static int significant_digits(const char *text)
+{
+  int n = 0;
+  bool leading = true;
+  for(; *text; text++) {
+    if(*text < '0' || *text > '9') continue;
+    if(*text != '0') leading = false;
+    if(!leading) n++;
+  }
+  return n;
+}
+
+static void check_spellings(long n, int decimals)
+{
+  char text[32], alt[40];
+  long unit = 1;
+  for(int i = 0; i < decimals; i++) unit *= 10;
+  const char *sign = (n < 0) ? "-" : "";
+  long a = labs(n);
+  snprintf(text, sizeof(text), "%s%ld.%0*ld", sign, a / unit, decimals, a % unit);
+  long allowed = (significant_digits(text) > 7) ? 2 : 1;
+  check_float(text, allowed);
+
+  if(a / unit == 0) { // ".5", "-.5"
+    snprintf(alt, sizeof(alt), "%s.%0*ld", sign, decimals, a % unit);
+    check_float(alt, allowed);
+  }
+  if(n > 0) {         // "+1.5"
+    snprintf(alt, sizeof(alt), "+%s", text);
+    check_float(alt, allowed);
+  }
+  snprintf(alt, sizeof(alt), "%s00 X1", text); // Trailing zeros, then the next word
+  check_float(alt, allowed);
+}
+
+int main()
+{
+  // Slicer grids. 0.001 mm over +-2000 mm is 4 million numbers.
+  static const struct { int decimals; long range; } grids[] = {
+    {1, 100000}, {2, 1000000}, {3, 2000000}, {4, 2000000} };
+  for(size_t g = 0; g < sizeof(grids) / sizeof(grids[0]); g++)
+    for(long n = -grids[g].range; n <= grids[g].range; n++)
+      check_spellings(n, grids[g].decimals);
+
+  // Whole numbers, with and without a point
+  char text[48];
+  for(long n = -100000; n <= 100000; n++) {
+    snprintf(text, sizeof(text), "%ld", n);
+    check_float(text, 0);
+    check_long(text);
+    snprintf(text, sizeof(text), "%ld.", n);
+    check_float(text, 0);
+    check_long(text);
+  }
+  static const long edges[] = { 2147483647L, -2147483647L, 1000000000L, -999999999L, 16777217L };
+  for(size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+    snprintf(text, sizeof(text), " %ld", edges[i]);
+    check_long(text);
+    check_float(text, 2);
+  }
+
+  // Floats printed with 9 significant digits, but no more than the 9 decimals parse_float()
+  // reads, every 64th float between 1e-3 and 1e5
+  for(float f = 1e-3f; f < 1e5f; ) {
+    int decimals = 9 - 1 - (int)floorf(log10f(f));
+    if(decimals > 9) decimals = 9;
+    snprintf(text, sizeof(text), "%.*f", decimals, f);
+    check_float(text, 2);
+    text[0] = '-';
+    snprintf(text + 1, sizeof(text) - 1, "%.*f", decimals, f);
+    check_float(text, 2);
+    int32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    bits += 64;
+    memcpy(&f, &bits, sizeof(f));
+  }
+
+  // Not a number: nothing is consumed
+  static const char *junk[] = { "", "X1", "-", "+", ".", "-.", " ", "+-1" };
+  for(size_t i = 0; i < sizeof(junk) / sizeof(junk[0]); i++)
+    check_float(junk[i], 0);
+
+  printf("%lu numbers, %lu failed\n", cases, failures);
+  return failures ? 1 : 0;
+}
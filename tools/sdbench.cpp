@@ -0,0 +1,237 @@
+/*
+  sdbench - runs the SD code of the firmware (SdVolume, SdBaseFile, CardReader) on a disk image
+    sdbench [-c command_us] [-k block_us] [-v] card.img [file]
+
+  The firmware sources are compiled as they are; only Sd2Card is replaced by host/sdimage.cpp,
+  which reads and writes the image and counts what a real card would have been sent. With
+  -c/-k every command and every block is charged that many microseconds (defaults 100 and 600,
+  about a card at SPI_FULL_SPEED), the "card" times below are these sums. -v shows the serial
+  output of the firmware.
+
+  - M20:    CardReader::ls() over the whole card
+  - menu:   getnrfilenames() and getfilename() for every entry of the root directory
+  - read:   file (a name on the card) through CardReader::get() like an SD print
+  - upload: the lines of that file written back as UPLOAD.G through write_command() like M28,
+            and the raw bytes as UPLOADB.G like M28 B. Both are read back and compared.
+  - job:    if the file is an SD job made by binjob, it is printed through bin_job_run() into a
+            planner that takes BLOCK_BUFFER_SIZE - 1 moves per loop(). Then it is printed again
+            from the middle layer on (M26 L), that has to end where the whole job ended.
+
+  An image can be made with "mkfs.fat -C -F 32 card.img 262144" and filled with
+  "mcopy -i card.img part.g ::". The upload changes the image, so use a copy.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <string>
+
+#include "../Marlin/Marlin.h"
+#include "../Marlin/cardreader.h"
+#include "../Marlin/binprotocol.h"
+#include "host/sdimage.h"
+
+CardReader card;
+
+// Called by cardreader.cpp at the end of a print
+void enquecommand(const char *) {}
+void st_synchronize() {}
+void quickStop() {}
+
+// The parts of Marlin.ino binprotocol.cpp uses, moves go into a planner that is emptied
+// between the calls of bin_job_run()
+float current_position[NUM_AXIS];
+unsigned char LaserPower;
+static uint8_t planned;
+static unsigned long moves, laser_moves;
+static bool job_finished;
+
+uint8_t movesplanned() { return planned; }
+bool IsStopped() { return false; }
+void sd_print_finished() { job_finished = true; card.printingHasFinished(); }
+
+void prepare_binary_move(const float target[NUM_AXIS], float, int laser)
+{
+  for(int i = 0; i < NUM_AXIS; i++)
+    current_position[i] = target[i];
+  if(laser >= 0) LaserPower = laser;
+  planned++;
+  moves++;
+  if(LaserPower) laser_moves++;
+}
+
+static double now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static double started;
+
+static void begin()
+{
+  sd_image_reset_stats();
+  started = now();
+}
+
+static void report(const char *what, unsigned long bytes)
+{
+  double host = now() - started;
+  printf("%-8s", what);
+  if(bytes)
+    printf(" %lu bytes, host %.1f MB/s, card %.3f s (%.0f kB/s)", bytes,
+      bytes / host / 1e6, sd_stats.card_us / 1e6, bytes / (sd_stats.card_us / 1e6) / 1e3);
+  else
+    printf(" host %.3f ms, card %.3f s", host * 1e3, sd_stats.card_us / 1e6);
+  printf("\n         %lu blocks read, %lu written, %lu commands (%lu CMD17, %lu CMD18, %lu CMD12)\n",
+    sd_stats.blocks_read, sd_stats.blocks_written, sd_stats.commands,
+    sd_stats.single_reads, sd_stats.stream_starts, sd_stats.stream_stops);
+}
+
+// Whole file through get() as an SD print reads it
+static bool read_file(const char *name, std::string &data)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "%s", name);
+  card.openFile(path, true);
+  card.setIndex(0); // Also the header of an SD job
+  data.clear();
+  int16_t c;
+  while((c = card.get()) >= 0)
+    data += (char)c;
+  card.closefile();
+  return !data.empty();
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long command_us = 100, block_us = 600;
+  int opt;
+  while((opt = getopt(argc, argv, "c:k:v")) != -1) {
+    if(opt == 'c') command_us = atol(optarg);
+    else if(opt == 'k') block_us = atol(optarg);
+    else if(opt == 'v') host_serial_echo = true;
+    else {
+      fprintf(stderr, "usage: %s [-c command_us] [-k block_us] [-v] card.img [file]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(argc - optind != 1 && argc - optind != 2) {
+    fprintf(stderr, "usage: %s [-c command_us] [-k block_us] [-v] card.img [file]\n", argv[0]);
+    return 1;
+  }
+  if(!sd_image_open(argv[optind]))
+    return 1;
+  sd_image_timing(command_us, block_us);
+
+  card.initsd();
+  if(!card.cardOK) {
+    fprintf(stderr, "%s: no FAT16/FAT32 volume found\n", argv[optind]);
+    return 1;
+  }
+
+  begin();
+  card.ls();
+  report("M20", 0);
+  printf("         %lu lines listed\n", host_serial_lines);
+
+  begin();
+  uint16_t files = card.getnrfilenames();
+  for(uint16_t i = 0; i < files; i++)
+    card.getfilename(i);
+  report("menu", 0);
+  printf("         %u entries\n", files);
+
+  if(argc - optind == 1)
+    return 0;
+
+  std::string data;
+  begin();
+  if(!read_file(argv[optind + 1], data)) {
+    fprintf(stderr, "%s: not found on the card or empty\n", argv[optind + 1]);
+    return 1;
+  }
+  report("read", data.size());
+
+  // M28: lines as they come out of get_command(), write_command() adds the line ends
+  bool job = data.compare(0, 4, BIN_JOB_MAGIC) == 0;
+  std::string expected;
+  char name[] = "UPLOAD.G";
+  begin();
+  card.openFile(name, false);
+  size_t pos = job ? data.size() : 0; // No lines in a job
+  while(pos < data.size()) {
+    size_t eol = data.find_first_of("\r\n", pos);
+    if(eol == std::string::npos) eol = data.size();
+    if(eol > pos) {
+      std::string line = data.substr(pos, eol - pos);
+      card.write_command(&line[0]);
+      expected += line + "\r\n";
+    }
+    pos = eol + 1;
+  }
+  card.closefile();
+  if(!job)
+    report("upload", expected.size());
+
+  char binname[] = "UPLOADB.G";
+  begin();
+  card.openFile(binname, false);
+  for(pos = 0; pos < data.size(); pos += 512)
+    card.write_data((const uint8_t *)data.data() + pos, data.size() - pos < 512 ? data.size() - pos : 512);
+  card.closefile();
+  report("upload B", data.size());
+
+  std::string back;
+  int failed = 0;
+  if(!job && (!read_file(name, back) || back != expected)) {
+    fprintf(stderr, "UPLOAD.G does not read back as written\n");
+    failed = 1;
+  }
+  if(!read_file(binname, back) || back != data) {
+    fprintf(stderr, "UPLOADB.G does not read back as written\n");
+    failed = 1;
+  }
+
+  if(job) {
+    float end[NUM_AXIS];
+    unsigned long layers = (uint8_t)data[8] | (uint8_t)data[9] << 8 | (uint8_t)data[10] << 16 | (uint32_t)(uint8_t)data[11] << 24;
+    char path[64];
+    snprintf(path, sizeof(path), "%s", argv[optind + 1]);
+    for(int run = 0; run < 2 && layers > 0; run++) {
+      begin();
+      card.openFile(path, true);
+      if(run == 1)
+        bin_job_seek_layer(layers / 2);
+      card.startFileprint();
+      bin_job_start();
+      moves = laser_moves = 0;
+      job_finished = false;
+      unsigned long loops = 0;
+      while(card.sdprinting) {
+        bin_job_run();
+        planned = 0;
+        card.prefetch();
+        loops++;
+      }
+      report(run ? "job half" : "job", run ? 0 : data.size());
+      printf("         %lu moves (%lu with the laser on), %lu loop() calls, ends at X%.3f Y%.3f Z%.3f\n",
+        moves, laser_moves, loops, current_position[X_AXIS], current_position[Y_AXIS], current_position[RZ_AXIS]);
+      if(!job_finished) {
+        fprintf(stderr, "%s: the job stopped before its end\n", argv[optind + 1]);
+        failed = 1;
+      }
+      if(run == 0)
+        memcpy(end, current_position, sizeof(end));
+      else if(memcmp(end, current_position, sizeof(end)) != 0) {
+        fprintf(stderr, "%s: the second half alone ends elsewhere\n", argv[optind + 1]);
+        failed = 1;
+      }
+    }
+  }
+  sd_image_close();
+  return failed;
+}
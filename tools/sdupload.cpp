@@ -0,0 +1,172 @@
+/*
+  sdupload - copies a file to the SD card of the printer with M28 B (SD_BINARY_UPLOAD)
+    sdupload [-b baud] device file [name on the card]
+
+  The file goes as raw bytes instead of G-code lines: after "M28 B<size> <name>" and the
+  "Writing to file" answer it is sent in blocks of 512 bytes, each full block is acknowledged
+  with "ok" before the next one follows. The name on the card defaults to the file name and
+  has to be 8.3. Reported are the bytes per second from the first byte to "Done saving file".
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+static int fd;
+
+static double now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static speed_t baud_constant(long baud)
+{
+  switch(baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B250000
+    case 250000: return B250000;
+#endif
+#ifdef B500000
+    case 500000: return B500000;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+  }
+  // USB serial (like on the OpenSL board) and ptys ignore the rate anyway
+  fprintf(stderr, "baud rate %ld not supported here, leaving the port speed as it is\n", baud);
+  return 0;
+}
+
+static void open_device(const char *path, long baud)
+{
+  fd = open(path, O_RDWR | O_NOCTTY);
+  if(fd < 0) { perror(path); exit(1); }
+  struct termios t;
+  if(tcgetattr(fd, &t) == 0) {
+    cfmakeraw(&t);
+    speed_t speed = baud_constant(baud);
+    if(speed != 0) {
+      cfsetispeed(&t, speed);
+      cfsetospeed(&t, speed);
+    }
+    t.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(fd, TCSANOW, &t);
+  }
+}
+
+// Next line from the device, false if none came within timeout seconds
+static bool read_line(std::string &line, double timeout)
+{
+  static std::string pending;
+  double end = now() + timeout;
+  for(;;) {
+    size_t eol = pending.find('\n');
+    if(eol != std::string::npos) {
+      line = pending.substr(0, eol);
+      pending.erase(0, eol + 1);
+      if(!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+      return true;
+    }
+    double left = end - now();
+    if(left <= 0)
+      return false;
+    struct pollfd p = { fd, POLLIN, 0 };
+    if(poll(&p, 1, (int)(left * 1000) + 1) > 0) {
+      char buf[256];
+      int n = read(fd, buf, sizeof(buf));
+      if(n <= 0) { perror("read"); exit(1); }
+      pending.append(buf, n);
+    }
+  }
+}
+
+static void send(const void *data, size_t n)
+{
+  if(write(fd, data, n) != (ssize_t)n) { perror("write"); exit(1); }
+}
+
+// Waits for a line starting with text, other lines are shown
+static void expect(const char *text)
+{
+  std::string line;
+  for(;;) {
+    if(!read_line(line, 10.0)) {
+      fprintf(stderr, "no \"%s\" for 10 s, giving up\n", text);
+      exit(1);
+    }
+    if(line.compare(0, strlen(text), text) == 0)
+      return;
+    printf("< %s\n", line.c_str());
+    if(line.compare(0, 11, "open failed") == 0)
+      exit(1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  long baud = 250000;
+  int opt;
+  while((opt = getopt(argc, argv, "b:")) != -1) {
+    if(opt == 'b') baud = atol(optarg);
+    else {
+      fprintf(stderr, "usage: %s [-b baud] device file [name on the card]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(argc - optind != 2 && argc - optind != 3) {
+    fprintf(stderr, "usage: %s [-b baud] device file [name on the card]\n", argv[0]);
+    return 1;
+  }
+  const char *path = argv[optind + 1];
+  const char *name = (argc - optind == 3) ? argv[optind + 2] : strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+  FILE *in = fopen(path, "rb");
+  if(in == NULL) { perror(path); return 1; }
+  std::vector<unsigned char> data;
+  unsigned char buf[4096];
+  size_t n;
+  while((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(in);
+
+  open_device(argv[optind], baud);
+  std::string line;
+  while(read_line(line, 2.0)) // Opening the port may reset the board, let it boot
+    printf("< %s\n", line.c_str());
+
+  char cmd[64];
+  snprintf(cmd, sizeof(cmd), "M28 B%lu %s\n", (unsigned long)data.size(), name);
+  send(cmd, strlen(cmd));
+  expect("Writing to file");
+
+  double start = now();
+  for(size_t pos = 0; pos < data.size(); pos += 512) {
+    size_t len = data.size() - pos < 512 ? data.size() - pos : 512;
+    send(&data[pos], len);
+    if(len == 512 && pos + 512 < data.size())
+      expect("ok");
+  }
+  expect("Done saving file");
+  double elapsed = now() - start;
+  expect("ok");
+
+  printf("%lu bytes in %.2f s: %.0f bytes/s\n", (unsigned long)data.size(), elapsed, data.size() / elapsed);
+  close(fd);
+  return 0;
+}
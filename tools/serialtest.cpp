@@ -0,0 +1,163 @@
+/*
+  serialtest - runs MarlinSerial, the interrupt driven UART driver of the ATmega2560 boards, on
+  the host
+    serialtest
+
+  MarlinSerial.cpp is built as it is for the ATmega2560, with USART0 modelled on a pty by
+  host/uart.cpp: the bytes written to the other end of the pty arrive through USART0_RX_vect,
+  the bytes MarlinSerial sends come out there at one byte per timer tick. Checked are the RX
+  ring (order, overflow count, flush), the TX ring (order, room while it drains, the direct
+  send with interrupts off, flushTx()) and the number printing. Built and run by "make check"
+  like fwtest.
+*/
+
+#include "Marlin.h"
+#include "MarlinSerial.h"
+#include "uart.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <string>
+
+static int fd, checks, failures;
+
+static void check(bool ok, const char *what)
+{
+  checks++;
+  if(!ok) {
+    failures++;
+    fprintf(stderr, "FAILED: %s\n", what);
+  }
+}
+
+static void pause_ms(int ms)
+{
+  struct timespec t = { ms / 1000, (ms % 1000) * 1000000L }; // nanosleep returns on every tick
+  while(nanosleep(&t, &t) != 0) {}
+}
+
+// What MarlinSerial sent, until nothing more came for 100 ms. The timer tick interrupts
+// poll(), so the quiet time is measured here.
+static std::string host_read()
+{
+  std::string got;
+  unsigned long last = millis();
+  while(millis() - last < 100) {
+    struct pollfd p = { fd, POLLIN, 0 };
+    if(poll(&p, 1, 10) <= 0)
+      continue;
+    char buf[256];
+    int n = read(fd, buf, sizeof(buf));
+    if(n > 0) {
+      got.append(buf, n);
+      last = millis();
+    }
+  }
+  return got;
+}
+
+static void host_write(const std::string &s)
+{
+  if(write(fd, s.data(), s.size()) != (ssize_t)s.size())
+    perror("write");
+}
+
+static std::string pattern(int n)
+{
+  std::string s;
+  for(int i = 0; i < n; i++)
+    s += (char)(' ' + i % 95);
+  return s;
+}
+
+static void test_receive()
+{
+  host_write(pattern(200));
+  pause_ms(100);
+  check(MSerial.available() == 200, "200 bytes received");
+  check(MSerial.peek() == ' ', "peek() shows the first byte");
+  std::string got;
+  int c;
+  while((c = MSerial.read()) >= 0)
+    got += (char)c;
+  check(got == pattern(200), "received bytes in order");
+  check(MSerial.rxOverflows() == 0, "no overflow for 200 bytes");
+}
+
+static void test_receive_overflow()
+{
+  host_write(pattern(300));
+  pause_ms(150);
+  check(MSerial.available() == RX_BUFFER_SIZE - 1, "a full RX ring holds RX_BUFFER_SIZE-1 bytes");
+  check(MSerial.rxOverflows() == 300 - (RX_BUFFER_SIZE - 1), "the dropped bytes are counted");
+  MSerial.clearRxOverflows();
+  check(MSerial.rxOverflows() == 0, "clearRxOverflows()");
+  MSerial.flush();
+  check(MSerial.available() == 0 && MSerial.read() == -1, "flush() empties the RX ring");
+}
+
+static void test_send()
+{
+  std::string text = pattern(1000);
+  MSerial.write(text.c_str());
+  check(MSerial.availableForWrite() < TX_BUFFER_SIZE - 1, "the TX ring fills while it drains");
+  check(host_read() == text, "1000 bytes sent in order through the TX ring");
+  check(MSerial.availableForWrite() == TX_BUFFER_SIZE - 1, "the TX ring is empty again");
+  check(!(UCSR0B & _BV(UDRIE0)), "the UDRE interrupt is off once the TX ring is empty");
+}
+
+static void test_send_interrupts_off()
+{
+  // Like printing from an ISR: nothing drains the ring, write() has to send itself
+  std::string text = pattern(2 * TX_BUFFER_SIZE);
+  cli();
+  MSerial.write(text.c_str());
+  sei();
+  check(host_read() == text, "bytes written with interrupts off arrive in order");
+}
+
+static void test_flush_tx()
+{
+  // kill(): the message has to be out before interrupts go off for good
+  std::string text = pattern(TX_BUFFER_SIZE + 50);
+  MSerial.write(text.c_str());
+  MSerial.flushTx();
+  check(MSerial.availableForWrite() == TX_BUFFER_SIZE - 1, "flushTx() empties the TX ring");
+  MSerial.write(text.c_str());
+  cli();
+  MSerial.flushTx();
+  sei();
+  check(MSerial.availableForWrite() == TX_BUFFER_SIZE - 1, "flushTx() with interrupts off");
+  check(host_read() == text + text, "bytes of flushTx() arrive in order");
+}
+
+static void test_print()
+{
+  MSerial.print(-12);
+  MSerial.print(' ');
+  MSerial.print(3.14159, 3);
+  MSerial.print(' ');
+  MSerial.println(255, HEX);
+  MSerial.print(0UL);
+  check(host_read() == "-12 3.142 FF\r\n0", "print() of numbers");
+}
+
+int main()
+{
+  fd = host_uart_open(100, 4);
+  if(fd < 0)
+    return 1;
+  MSerial.begin(115200);
+  test_receive();
+  test_receive_overflow();
+  test_send();
+  test_send_interrupts_off();
+  test_flush_tx();
+  test_print();
+  host_uart_close();
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
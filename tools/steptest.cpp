@@ -0,0 +1,138 @@
+/*
+  steptest - runs the stepper interrupt on the host and checks the profile M603 reports
+    steptest
+
+  Marlin.ino, planner.cpp and stepper.cpp are compiled in as they are, with STEPPER_ISR_PROFILE
+  on and timer 1 modelled by host/timer1.cpp: the test queues moves and calls the stepper ISR
+  until the queue is empty, each call taking a set number of timer ticks. M603 then has to
+  report every one of these interrupts with that duration, and as missed the ones that ran
+  past OCR1A. Built and run by "make check" like fwtest.
+*/
+
+#include "../Marlin/Marlin.ino"
+#include "host/timer1.h"
+
+static int checks, failures;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+  checks++;
+  if(!ok) {
+    fprintf(stderr, "steptest.cpp:%d: %s\n", line, what);
+    failures++;
+  }
+}
+
+static void send(const char *text)
+{
+  host_serial_input(text);
+  for(int i = 0; i < 10000 && (MYSERIAL.available() > 0 || buflen > 0); i++)
+    loop();
+}
+
+// Runs the stepper ISR until the queue is empty, returns the number of interrupts
+static unsigned long run_steps(uint16_t latency, uint16_t duration)
+{
+  unsigned long n = 0;
+  while(blocks_queued() && n < 1000000) {
+    host_timer1_interrupt(latency, duration);
+    n++;
+  }
+  return n;
+}
+
+struct profile {
+  unsigned long count;          // Interrupts over all phases
+  unsigned short min, max;      // Over all phases
+  unsigned long missed, latency;
+  bool dac;                     // The time DAC writes waited for the SD card is reported
+};
+
+// M603 output, "pop n:3 min:100 avg:100 max:100 hist:0,0,3,0,0,0,0,0" for each phase
+static bool read_profile(profile *p)
+{
+  host_serial_clear();
+  send("M603\n");
+  memset(p, 0, sizeof(*p));
+  p->min = 0xFFFF;
+  const char *out = host_serial_output();
+  static const char *phases[] = { "pop", "accel", "cruise", "decel" };
+  for(int i = 0; i < 4; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "%s n:", phases[i]);
+    const char *line = strstr(out, key);
+    if(line == NULL)
+      return false;
+    unsigned long n = strtoul(line + strlen(key), NULL, 10);
+    p->count += n;
+    if(n == 0)
+      continue;
+    unsigned long min, avg, max;
+    if(sscanf(strstr(line, " min:"), " min:%lu avg:%lu max:%lu", &min, &avg, &max) != 3)
+      return false;
+    if(min < p->min) p->min = min;
+    if(max > p->max) p->max = max;
+  }
+  const char *missed = strstr(out, "missed:");
+  if(missed == NULL || sscanf(missed, "missed:%lu max latency:%lu", &p->missed, &p->latency) != 2)
+    return false;
+  p->dac = strstr(missed, " DAC held by SD max us:") != NULL;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Quick interrupts: all recorded, none missed
+static void test_profile()
+{
+  send("M603 R\n");
+  send("G1 X5 Y5 F3000\nG1 X10 Y0\nG1 Z0.5 F300\n");
+  host_timer1_wraps = 0;
+  unsigned long n = run_steps(10, 90);
+  CHECK(n > 0 && !blocks_queued());
+  CHECK(host_timer1_wraps == 0);
+
+  profile p;
+  CHECK(read_profile(&p));
+  CHECK(p.count == n);
+  CHECK(p.min == 90 && p.max == 90);
+  CHECK(p.missed == 0);
+  CHECK(p.latency == 10);
+  #if defined(GALVO_SS_PIN) && !defined(GALVO_USART_SPI)
+  CHECK(p.dac);
+  #endif
+}
+
+// Interrupts that outlast the step period are still recorded with their full duration. At
+// 400 mm/s the galvo steps come every ~345 ticks, so the counter wraps once in each, and at
+// the end of the acceleration it starts over below the entry count.
+static void test_profile_missed()
+{
+  send("M603 R\n");
+  send("G1 X110 Y0 F24000\n");
+  host_timer1_wraps = 0;
+  unsigned long n = run_steps(20, 400);
+  CHECK(n > 0 && !blocks_queued());
+  CHECK(host_timer1_wraps > 0);
+
+  profile p;
+  CHECK(read_profile(&p));
+  CHECK(p.count == n);
+  CHECK(p.missed == host_timer1_wraps);
+  CHECK(p.min == 400 && p.max == 400);
+  CHECK(p.latency == 20);
+
+  send("M603 R\n");
+  CHECK(read_profile(&p));
+  CHECK(p.count == 0 && p.missed == 0 && p.latency == 0);
+}
+
+int main()
+{
+  setup();
+  test_profile();
+  test_profile_missed();
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
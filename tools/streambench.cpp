@@ -0,0 +1,220 @@
+/*
+  streambench - measures how fast the firmware accepts and acknowledges G-code over serial
+    streambench [-b baud] [-w window] device input.gcode
+
+  The lines of the file (comments and blank lines dropped) are sent with line numbers and
+  checksums like a host program does, starting with N0 M110. Up to window lines are kept in
+  flight (default 1: wait for each ok). Every line is answered by exactly one ok, also when it
+  was rejected with "Resend:", so the window is kept by counting oks; a resend rewinds to the
+  requested line. Before streaming the counters of the firmware are cleared with M605 R, at
+  the end M605 reports them (lines, resends and, on UART boards, RX overflows).
+
+  Reported are lines/s, bytes/s, resends and the latency from sending a line to its ok.
+  The device can be a printer or any terminal, e.g. one end of a pty pair made with socat.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+#include <vector>
+#include <string>
+#include <deque>
+#include <algorithm>
+
+static int fd;
+
+static double now()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static speed_t baud_constant(long baud)
+{
+  switch(baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B250000
+    case 250000: return B250000;
+#endif
+#ifdef B500000
+    case 500000: return B500000;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+  }
+  // USB serial (like on the OpenSL board) and ptys ignore the rate anyway
+  fprintf(stderr, "baud rate %ld not supported here, leaving the port speed as it is\n", baud);
+  return 0;
+}
+
+static void open_device(const char *path, long baud)
+{
+  fd = open(path, O_RDWR | O_NOCTTY);
+  if(fd < 0) { perror(path); exit(1); }
+  struct termios t;
+  if(tcgetattr(fd, &t) == 0) {
+    cfmakeraw(&t);
+    speed_t speed = baud_constant(baud);
+    if(speed != 0) {
+      cfsetispeed(&t, speed);
+      cfsetospeed(&t, speed);
+    }
+    t.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(fd, TCSANOW, &t);
+  }
+}
+
+// Next line from the device, false if none came within timeout seconds
+static bool read_line(std::string &line, double timeout)
+{
+  static std::string pending;
+  double end = now() + timeout;
+  for(;;) {
+    size_t eol = pending.find('\n');
+    if(eol != std::string::npos) {
+      line = pending.substr(0, eol);
+      pending.erase(0, eol + 1);
+      if(!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+      return true;
+    }
+    double left = end - now();
+    if(left <= 0)
+      return false;
+    struct pollfd p = { fd, POLLIN, 0 };
+    if(poll(&p, 1, (int)(left * 1000) + 1) > 0) {
+      char buf[256];
+      int n = read(fd, buf, sizeof(buf));
+      if(n <= 0) { perror("read"); exit(1); }
+      pending.append(buf, n);
+    }
+  }
+}
+
+static unsigned long bytes_sent;
+
+static void send_numbered(long n, const std::string &cmd)
+{
+  char text[160];
+  int len = snprintf(text, sizeof(text) - 8, "N%ld %s", n, cmd.c_str());
+  unsigned char checksum = 0;
+  for(int i = 0; i < len; i++)
+    checksum ^= text[i];
+  len += sprintf(text + len, "*%d\n", checksum);
+  if(write(fd, text, len) != len) { perror("write"); exit(1); }
+  bytes_sent += len;
+}
+
+struct in_flight {
+  long n;
+  double sent;
+  unsigned long epoch;    // Rewinds before this line was sent
+};
+
+int main(int argc, char **argv)
+{
+  long baud = 250000;
+  unsigned window = 1;
+  int opt;
+  while((opt = getopt(argc, argv, "b:w:")) != -1) {
+    if(opt == 'b') baud = atol(optarg);
+    else if(opt == 'w') window = atoi(optarg) > 0 ? atoi(optarg) : 1;
+    else {
+      fprintf(stderr, "usage: %s [-b baud] [-w window] device input.gcode\n", argv[0]);
+      return 1;
+    }
+  }
+  if(argc - optind != 2) {
+    fprintf(stderr, "usage: %s [-b baud] [-w window] device input.gcode\n", argv[0]);
+    return 1;
+  }
+
+  // Line 0 resets the numbering, 1 clears the counters, the file follows, M605 reports
+  std::vector<std::string> lines;
+  lines.push_back("M110");
+  lines.push_back("M605 R");
+  FILE *in = fopen(argv[optind + 1], "r");
+  if(in == NULL) { perror(argv[optind + 1]); return 1; }
+  char buf[256];
+  while(fgets(buf, sizeof(buf), in)) {
+    char *c = strchr(buf, ';');
+    if(c) *c = '\0';
+    std::string s(buf);
+    s.erase(0, s.find_first_not_of(" \t\r\n"));
+    s.erase(s.find_last_not_of(" \t\r\n") + 1);
+    if(!s.empty()) lines.push_back(s);
+  }
+  fclose(in);
+  lines.push_back("M605");
+  size_t file_lines = lines.size() - 3;
+
+  open_device(argv[optind], baud);
+  std::string line;
+  while(read_line(line, 2.0)) // Opening the port may reset the board, let it boot
+    printf("< %s\n", line.c_str());
+
+  std::deque<in_flight> flight;
+  std::vector<double> latencies;
+  size_t next = 0;
+  unsigned long epoch = 0, resends = 0;
+  double start = 0;
+  while(next < lines.size() || !flight.empty()) {
+    while(next < lines.size() && flight.size() < window) {
+      if(next == 2 && start == 0) {
+        if(!flight.empty()) break;  // The file starts once M605 R is done
+        start = now();
+      }
+      in_flight f = { (long)next, now(), epoch };
+      send_numbered(next, lines[next]);
+      flight.push_back(f);
+      next++;
+    }
+    if(!read_line(line, 10.0)) {
+      fprintf(stderr, "no answer for 10 s, %u lines in flight, giving up\n", (unsigned)flight.size());
+      return 1;
+    }
+    if(line.compare(0, 2, "ok") == 0) {
+      if(flight.empty())
+        continue;
+      if(flight.front().n >= 2 && flight.front().n < (long)lines.size() - 1)
+        latencies.push_back(now() - flight.front().sent);
+      flight.pop_front();
+    }
+    else if(line.compare(0, 7, "Resend:") == 0) {
+      long n = atol(line.c_str() + 7);
+      // Lines sent before the last rewind are answered with resends too, only the first counts
+      if(!flight.empty() && flight.front().epoch == epoch && n >= 0 && n < (long)lines.size()) {
+        resends++;
+        epoch++;
+        next = n;
+      }
+    }
+    else
+      printf("< %s\n", line.c_str());
+  }
+  double elapsed = now() - start;
+
+  std::sort(latencies.begin(), latencies.end());
+  double sum = 0;
+  for(size_t i = 0; i < latencies.size(); i++) sum += latencies[i];
+  printf("%lu lines in %.2f s: %.1f lines/s, %.0f bytes/s, window %u, %lu resends\n",
+    (unsigned long)file_lines, elapsed, file_lines / elapsed, bytes_sent / elapsed, window, resends);
+  if(!latencies.empty())
+    printf("latency to ok: mean %.2f ms, median %.2f ms, 99%% %.2f ms, max %.2f ms\n",
+      1000 * sum / latencies.size(), 1000 * latencies[latencies.size() / 2],
+      1000 * latencies[latencies.size() * 99 / 100], 1000 * latencies.back());
+  close(fd);
+  return 0;
+}